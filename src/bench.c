@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ui/tui.h"
+
+// Renders scenarios headless into a pseudo terminal and prints one tab
+// separated line per scenario to the real stdout.
+
+typedef struct BENCH_SCENARIO {
+  const char *name;
+  WIDGET_BUILDER build;
+  void (*before_frame)(TUI *tui);  // may be NULL
+} BENCH_SCENARIO;
+
+int bench_master = -1;
+int bench_frame = 0;
+int bench_scroll = 0;
+TUI_SCROLL_STATE bench_scroll_state = {0};
+TUI_LOG *bench_log = NULL;
+int bench_width = 200;
+int bench_height = 60;
+
+int64_t bench_time() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+void bench_set_size(int width, int height) {
+  const struct winsize size = {.ws_row = height, .ws_col = width};
+  ioctl(bench_master, TIOCSWINSZ, &size);
+  raise(SIGWINCH);
+}
+
+// Writes all of data as the terminal, a scenario that lost some of its
+// input would measure fewer events than it reports
+void bench_write(const char *data, size_t size) {
+  while (size != 0) {
+    const ssize_t written = write(bench_master, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      fprintf(stderr, "can't write to the pseudo terminal\n");
+      exit(1);
+    }
+    data += written;
+    size -= written;
+  }
+}
+
+// Plays the terminal: swallows the output and answers cursor position
+// requests
+void *bench_drain(void *arg) {
+  (void)arg;
+  const char query[] = "\033[6n";
+  size_t matched = 0;
+  char buffer[1 << 16];
+  while (1) {
+    const ssize_t size = read(bench_master, buffer, sizeof(buffer));
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      return NULL;
+    }
+    for (ssize_t i = 0; i < size; ++i) {
+      if (buffer[i] == query[matched]) {
+        if (++matched == sizeof(query) - 1) {
+          bench_write("\033[1;1R", 6);
+          matched = 0;
+        }
+      } else {
+        matched = buffer[i] == query[0];
+      }
+    }
+  }
+}
+
+WIDGET *build_full_churn(TUI *tui, void *context) {
+  (void)context;
+  const int width = tui_get_width(tui) < 1023 ? tui_get_width(tui) : 1023;
+  const int height = tui_get_height(tui);
+  WIDGET_ARRAY *rows = tui_new_widget_array(height);
+  char line[1024];
+  for (int y = 0; y < height; ++y) {
+    memset(line, 'a' + (bench_frame + y) % 26, width);
+    line[width] = '\0';
+    rows->widgets[y] = tui_make_box(
+        MAX_WIDTH, 1,
+        tui_make_text(line, (COLOR)(1 + (bench_frame + y) % 7)),
+        (COLOR)(1 + (bench_frame + y + 3) % 7));
+  }
+  return tui_make_column(rows);
+}
+
+WIDGET *build_single_cell(TUI *tui, void *context) {
+  (void)tui;
+  (void)context;
+  const int lines = 20;
+  WIDGET_ARRAY *rows = tui_new_widget_array(lines + 1);
+  for (int y = 0; y < lines; ++y) {
+    rows->widgets[y] =
+        tui_make_literal_text("a line that stays the same", COLOR_GREEN);
+  }
+  char digit[2] = {'0' + bench_frame % 10, '\0'};
+  rows->widgets[lines] = tui_make_text(digit, COLOR_RED);
+  return tui_make_box(MAX_WIDTH, MAX_HEIGHT, tui_make_column(rows),
+                      COLOR_BLUE);
+}
+
+WIDGET *build_deep_nesting(TUI *tui, void *context) {
+  (void)tui;
+  (void)context;
+  char text[32];
+  snprintf(text, sizeof(text), "frame %d", bench_frame);
+  WIDGET *widget = tui_make_text(text, COLOR_YELLOW);
+  for (int i = 0; i < 256; ++i) {
+    if (i % 2 == 0) {
+      widget = tui_make_column(tui_make_widget_array(widget));
+    } else {
+      widget = tui_make_box(MIN_WIDTH, MIN_HEIGHT, widget,
+                            (COLOR)(1 + i / 2 % 7));
+    }
+  }
+  return widget;
+}
+
+WIDGET *build_text_10k(TUI *tui, void *context) {
+  (void)tui;
+  (void)context;
+  const int size = 100;
+  WIDGET_ARRAY *rows = tui_new_widget_array(size);
+  for (int y = 0; y < size; ++y) {
+    WIDGET_ARRAY *texts = tui_new_widget_array(size);
+    for (int x = 0; x < size; ++x) {
+      const bool is_changed = y * size + x == bench_frame % (size * size);
+      texts->widgets[x] = tui_make_borrowed_text(
+          is_changed ? "#" : ".", 1, (COLOR)(1 + (x + y) % 7));
+    }
+    rows->widgets[y] = tui_make_row(texts);
+  }
+  return tui_make_column(rows);
+}
+
+void before_resize_storm(TUI *tui) {
+  (void)tui;
+  const int sizes[][2] = {{80, 24}, {bench_width, bench_height}, {120, 40}};
+  const int *size = sizes[bench_frame % 3];
+  bench_set_size(size[0], size[1]);
+}
+
+WIDGET *build_resize_storm(TUI *tui, void *context) {
+  (void)context;
+  const int height = tui_get_height(tui) / 3;
+  WIDGET_ARRAY *rows = tui_new_widget_array(height);
+  for (int y = 0; y < height; ++y) {
+    char text[64];
+    snprintf(text, sizeof(text), "row %d of %dx%d", y, tui_get_width(tui),
+             tui_get_height(tui));
+    rows->widgets[y] =
+        tui_make_box(MAX_WIDTH, 3, tui_make_text(text, COLOR_WHITE),
+                     (COLOR)(1 + y % 7));
+  }
+  return tui_make_column(rows);
+}
+
+void on_scroll(const MOUSE_ACTION *mouse_action, void *context) {
+  int *scroll = context;
+  if (mouse_action->button == MOUSE_BUTTON_SCROLL_DOWN) {
+    *scroll += mouse_action->count;
+  } else if (mouse_action->button == MOUSE_BUTTON_SCROLL_UP) {
+    *scroll -= mouse_action->count;
+  }
+}
+
+void before_scroll_burst(TUI *tui) {
+  char events[64 * 16];
+  int size = 0;
+  for (int i = 0; i < 64; ++i) {
+    size += snprintf(events + size, sizeof(events) - size, "\033[<%d;10;5M",
+                     i % 8 == 7 ? 64 : 65);
+  }
+  bench_write(events, size);
+  handle_input(tui);
+}
+
+WIDGET *build_scroll_burst(TUI *tui, void *context) {
+  (void)context;
+  const int height = tui_get_height(tui);
+  WIDGET_ARRAY *rows = tui_new_widget_array(height);
+  for (int y = 0; y < height; ++y) {
+    char text[32];
+    snprintf(text, sizeof(text), "line %d", bench_scroll + y);
+    rows->widgets[y] =
+        tui_make_text(text, (COLOR)(1 + (bench_scroll + y) % 7));
+  }
+  return tui_make_button(tui_make_box(MAX_WIDTH, MAX_HEIGHT,
+                                      tui_make_column(rows), COLOR_NO_COLOR),
+                         on_scroll, &bench_scroll);
+}
+
+WIDGET *build_huge_list_item(size_t index, void *context) {
+  (void)context;
+  char text[32];
+  snprintf(text, sizeof(text), "item %zu", index);
+  return tui_make_text(text, (COLOR)(1 + index % 7));
+}
+
+void before_huge_list(TUI *tui) {
+  char events[16 * 16];
+  int size = 0;
+  for (int i = 0; i < 16; ++i) {
+    size += snprintf(events + size, sizeof(events) - size, "\033[<%d;1;5M",
+                     bench_frame % 64 < 48 ? 65 : 64);
+  }
+  bench_write(events, size);
+  handle_input(tui);
+}
+
+WIDGET *build_huge_list(TUI *tui, void *context) {
+  (void)tui;
+  (void)context;
+  return tui_make_scroll_view(1000000, build_huge_list_item, NULL,
+                              &bench_scroll_state);
+}
+
+void before_log_tail(TUI *tui) {
+  (void)tui;
+  if (bench_log == NULL) {
+    bench_log = tui_new_log(1 << 20, 1 << 14);
+  }
+  // about 100KB a frame, in pieces that don't end on line ends
+  char text[4096];
+  for (int i = 0; i < 25; ++i) {
+    int size = 0;
+    while (size < (int)sizeof(text) - 64) {
+      size += snprintf(text + size, sizeof(text) - size,
+                       "frame %d piece %d: the quick brown fox jumps\n",
+                       bench_frame, i);
+    }
+    const int cut = bench_frame % 17;
+    tui_log_append(bench_log, text, size - cut);
+    tui_log_append(bench_log, text + size - cut, cut);
+  }
+}
+
+WIDGET *build_log_tail(TUI *tui, void *context) {
+  (void)tui;
+  (void)context;
+  return tui_make_box(MAX_WIDTH, MAX_HEIGHT,
+                      tui_make_log_view(bench_log, COLOR_GREEN),
+                      COLOR_NO_COLOR);
+}
+
+void before_log_still(TUI *tui) {
+  if (bench_log == NULL) {
+    bench_log = tui_new_log(1 << 12, 64);
+    char text[32];
+    for (int i = 0; i < 8; ++i) {
+      tui_log_append(bench_log, text,
+                     snprintf(text, sizeof(text), "line %d\n", i));
+    }
+  } else if (tui->cells[tui_get_width(tui)].text != 'l') {
+    // the log view is drawn again for the changes around it
+    fprintf(stderr, "log_still: the log view is not drawn\n");
+    exit(1);
+  }
+}
+
+WIDGET *build_log_still(TUI *tui, void *context) {
+  (void)tui;
+  (void)context;
+  // a log that doesn't change between the lines that do
+  char text[32];
+  snprintf(text, sizeof(text), "frame %d", bench_frame);
+  return tui_make_column(tui_make_widget_array(
+      tui_make_text(text, COLOR_WHITE),
+      tui_make_box(MAX_WIDTH, 8, tui_make_log_view(bench_log, COLOR_GREEN),
+                   COLOR_NO_COLOR),
+      tui_make_text(text, COLOR_WHITE)));
+}
+
+WIDGET *build_text_pane(TUI *tui, void *context) {
+  (void)tui;
+  (void)context;
+  // 16KB of words and tabs, wrapped at spaces and shown from another word
+  // every frame so it is laid out every frame
+  static char text[16 * 1024];
+  if (text[0] == '\0') {
+    const char *words[] = {"lorem", "ipsum", "dolor", "sit\t", "amet,",
+                           "consectetur", "adipiscing", "elit.\n"};
+    size_t size = 0;
+    for (int i = 0; size + 16 < sizeof(text); ++i) {
+      size += snprintf(text + size, sizeof(text) - size, "%s ",
+                       words[i * 7 % 8]);
+    }
+  }
+  const char *begin = text + bench_frame % 64 * 6;
+  const TUI_TEXT_STYLE style = {.wrap = TUI_TEXT_WRAP_WORD,
+                                .has_ellipsis = true};
+  return tui_make_box(
+      MAX_WIDTH, MAX_HEIGHT,
+      tui_make_styled_text(begin, strlen(begin), COLOR_WHITE, style, true),
+      COLOR_NO_COLOR);
+}
+
+const BENCH_SCENARIO scenarios[] = {
+    {"full_churn", build_full_churn, NULL},
+    {"single_cell", build_single_cell, NULL},
+    {"deep_nesting", build_deep_nesting, NULL},
+    {"text_10k", build_text_10k, NULL},
+    {"resize_storm", build_resize_storm, before_resize_storm},
+    {"scroll_burst", build_scroll_burst, before_scroll_burst},
+    {"huge_list", build_huge_list, before_huge_list},
+    {"log_tail", build_log_tail, before_log_tail},
+    {"log_still", build_log_still, before_log_still},
+    {"text_pane", build_text_pane, NULL},
+};
+
+void run_scenario(FILE *report, const BENCH_SCENARIO *scenario, int frames,
+                  int workers, bool use_output_thread, bool use_memory_sink) {
+  bench_set_size(bench_width, bench_height);
+  bench_scroll = 0;
+  bench_scroll_state = (TUI_SCROLL_STATE){0};
+  if (bench_log != NULL) {
+    tui_delete_log(bench_log);
+    bench_log = NULL;
+  }
+
+  TUI *tui = tui_init();
+  tui_use_frame_arena(tui, true);
+  tui_use_workers(tui, workers);
+  tui_use_output_thread(tui, use_output_thread);
+  if (use_memory_sink) {
+    tui_use_memory_sink(tui);
+  }
+
+  const int64_t start = bench_time();
+  for (bench_frame = 0; bench_frame < frames; ++bench_frame) {
+    if (scenario->before_frame != NULL) {
+      scenario->before_frame(tui);
+    }
+    _tui_render_frame(tui, scenario->build, NULL);
+    _tui_stats_end_frame(&tui->stats);
+    size_t size;
+    free(tui_take_sink_data(tui, &size));
+  }
+  // waits for the output thread to write what it still has
+  tui_use_output_thread(tui, false);
+  const double seconds = (bench_time() - start) / 1e9;
+  // takes in what the output thread recorded after the last frame
+  _tui_stats_end_frame(&tui->stats);
+
+  fprintf(report, "%s\t%d\t%.1f", scenario->name, frames, frames / seconds);
+  const TUI_STAGE stages[] = {TUI_STAGE_INPUT,  TUI_STAGE_BUILD,
+                              TUI_STAGE_LAYOUT, TUI_STAGE_RASTERIZE,
+                              TUI_STAGE_ENCODE, TUI_STAGE_WRITE};
+  for (size_t i = 0; i < sizeof(stages) / sizeof(*stages); ++i) {
+    fprintf(report, "\t%" PRIu64,
+            tui_get_stage_stats(tui, stages[i]).total / frames);
+  }
+  const TUI_COUNTER counters[] = {TUI_COUNTER_BYTES_WRITTEN,
+                                  TUI_COUNTER_CELLS_CHANGED,
+                                  TUI_COUNTER_WIDGETS_ALLOCATED};
+  for (size_t i = 0; i < sizeof(counters) / sizeof(*counters); ++i) {
+    fprintf(report, "\t%.1f",
+            (double)tui_get_counter_stats(tui, counters[i]).total / frames);
+  }
+  fprintf(report, "\n");
+  fflush(report);
+
+  tui_delete(tui);
+}
+
+void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--frames N] [--size WxH] [--workers N] "
+          "[--output-thread] [--memory-sink] [scenario...]\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int frames = 300;
+  int workers = 0;
+  bool use_output_thread = false;
+  bool use_memory_sink = false;
+  const char *selected[sizeof(scenarios) / sizeof(*scenarios)];
+  size_t selected_size = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &bench_width, &bench_height) != 2) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      workers = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--output-thread") == 0) {
+      use_output_thread = true;
+    } else if (strcmp(argv[i], "--memory-sink") == 0) {
+      use_memory_sink = true;
+    } else if (argv[i][0] != '-' &&
+               selected_size < sizeof(selected) / sizeof(*selected)) {
+      selected[selected_size++] = argv[i];
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (frames <= 0) {
+    usage(argv[0]);
+  }
+
+  bench_master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (bench_master == -1 || grantpt(bench_master) != 0 ||
+      unlockpt(bench_master) != 0) {
+    fprintf(stderr, "can't open a pseudo terminal\n");
+    exit(1);
+  }
+  const int slave = open(ptsname(bench_master), O_RDWR | O_NOCTTY);
+  if (slave == -1) {
+    fprintf(stderr, "can't open a pseudo terminal\n");
+    exit(1);
+  }
+  pthread_t drain;
+  pthread_create(&drain, NULL, bench_drain, NULL);
+
+  // the TUI draws to the pseudo terminal, the report goes where stdout was
+  const int original_stdin = dup(STDIN_FILENO);
+  const int original_stdout = dup(STDOUT_FILENO);
+  FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+  dup2(slave, STDIN_FILENO);
+  dup2(slave, STDOUT_FILENO);
+
+  fprintf(report,
+          "scenario\tframes\tfps\tinput_ns\tbuild_ns\tlayout_ns\t"
+          "rasterize_ns\tencode_ns\twrite_ns\tbytes_per_frame\t"
+          "cells_per_frame\twidgets_per_frame\n");
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(*scenarios); ++i) {
+    bool is_selected = selected_size == 0;
+    for (size_t j = 0; j < selected_size; ++j) {
+      is_selected |= strcmp(selected[j], scenarios[i].name) == 0;
+    }
+    if (is_selected) {
+      run_scenario(report, &scenarios[i], frames, workers, use_output_thread,
+                   use_memory_sink);
+    }
+  }
+
+  dup2(original_stdin, STDIN_FILENO);
+  dup2(original_stdout, STDOUT_FILENO);
+  close(slave);
+  pthread_join(drain, NULL);
+  fclose(report);
+  return 0;
+}
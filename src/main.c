@@ -4,14 +4,18 @@
 
 #include "ui/tui.h"
 
-bool is_clicked = false;
+typedef struct APP_STATE {
+  bool is_clicked;
+} APP_STATE;
 
-void on_button_click(const MOUSE_ACTION *mouse_action) {
-  is_clicked = !is_clicked;
+void on_button_click(const MOUSE_ACTION *mouse_action, void *context) {
+  APP_STATE *state = context;
+  state->is_clicked = !state->is_clicked;
 }
 
-WIDGET *ui_build(TUI *tui) {
-  if (is_clicked) {
+WIDGET *ui_build(TUI *tui, void *context) {
+  APP_STATE *state = context;
+  if (state->is_clicked) {
     char frame[20+4+1];
     const uint64_t fps = 1000000000/tui->last_frame;
     sprintf(frame, "%ldfps\n", fps);
@@ -25,8 +29,9 @@ WIDGET *ui_build(TUI *tui) {
                     20, 3,
                     tui_make_column(tui_make_widget_array(
                         tui_make_text(frame, COLOR_BLUE),
-                        tui_make_button(tui_make_text("Back", COLOR_RED),
-                                        on_button_click))),
+                        tui_make_button(
+                            tui_make_literal_text("Back", COLOR_RED),
+                            on_button_click, state))),
                     COLOR_WHITE))))),
         COLOR_MAGENTA);
   } else {
@@ -37,18 +42,21 @@ WIDGET *ui_build(TUI *tui) {
             tui_make_row(tui_make_widget_array(
                 tui_make_box(50, 0, NULL, COLOR_NO_COLOR),
                 tui_make_button(
-                    tui_make_box(MIN_WIDTH, MIN_HEIGHT,
-                                 tui_make_text("\nClick here\n", COLOR_BLUE),
-                                 COLOR_WHITE),
-                    on_button_click))))),
+                    tui_make_box(
+                        MIN_WIDTH, MIN_HEIGHT,
+                        tui_make_literal_text("\nClick here\n", COLOR_BLUE),
+                        COLOR_WHITE),
+                    on_button_click, state))))),
         COLOR_MAGENTA);
   }
 }
 
 int main() {
+  APP_STATE state = {.is_clicked = false};
   TUI *tui = tui_init();
+  tui_use_frame_arena(tui, true);
 
-  tui_start_app(tui, ui_build, 144);
+  tui_start_app(tui, ui_build, &state, 144);
 
   tui_delete(tui);
 
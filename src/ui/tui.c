@@ -1,12 +1,24 @@
 #include "tui.h"
+#include "tui_simd.h"
+#include "tui_text.h"
+#include "tui_width.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <stddef.h>
 #include <unistd.h>
 
 const int MAX_WIDTH = -1;
@@ -16,33 +28,773 @@ const int MIN_WIDTH = -2;
 const int MIN_HEIGHT = -2;
 
 const int FRAME_UNLIMITED = 0;
+const int FRAME_ON_DEMAND = -1;
+
+// TUIs that are not deleted yet, linked by next_live. The signal handler
+// wakes each of them.
+TUI *_Atomic _tui_live_tuis = NULL;
+// what SIGWINCH did before the first live TUI
+struct sigaction _tui_original_sigwinch;
+
+// set by SIGWINCH, the window size is only asked for when this is set
+volatile sig_atomic_t _tui_is_resize_pending = 1;
+
+void _tui_wake(int fd) {
+  const char c = 0;
+  // a full pipe already guarantees a wake up, so the result doesn't matter
+  (void)!write(fd, &c, 1);
+}
+
+void _tui_on_sigwinch(int signal) {
+  (void)signal;
+  const int saved_errno = errno;
+  _tui_is_resize_pending = 1;
+  for (TUI *tui = atomic_load(&_tui_live_tuis); tui != NULL;
+       tui = atomic_load(&tui->next_live)) {
+    if (tui->wake_pipe[1] != -1) {
+      _tui_wake(tui->wake_pipe[1]);
+    }
+  }
+  errno = saved_errno;
+}
+
+// the handler is installed along with the first live TUI
+void _tui_add_live_tui(TUI *tui) {
+  TUI *const first = atomic_load(&_tui_live_tuis);
+  if (first == NULL) {
+    struct sigaction action = {0};
+    action.sa_handler = _tui_on_sigwinch;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, &_tui_original_sigwinch);
+  }
+  atomic_store(&tui->next_live, first);
+  atomic_store(&_tui_live_tuis, tui);
+}
+
+// and put back once the last one is removed
+void _tui_remove_live_tui(TUI *tui) {
+  TUI *_Atomic *link = &_tui_live_tuis;
+  while (atomic_load(link) != tui) {
+    link = &atomic_load(link)->next_live;
+  }
+  atomic_store(link, atomic_load(&tui->next_live));
+  if (atomic_load(&_tui_live_tuis) == NULL) {
+    sigaction(SIGWINCH, &_tui_original_sigwinch, NULL);
+  }
+}
+
+void _tui_buffer_reserve(TUI_BUFFER *buffer, size_t size) {
+  if (buffer->capacity >= size) {
+    return;
+  }
+  size_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  buffer->data = realloc(buffer->data, capacity);
+  buffer->capacity = capacity;
+}
+
+void _tui_delete_buffer(TUI_BUFFER *buffer) {
+  free(buffer->data);
+  *buffer = (TUI_BUFFER){0};
+}
+
+void _tui_write_all(int fd, struct iovec *parts, int parts_size) {
+  while (parts_size != 0) {
+    ssize_t written = writev(fd, parts, parts_size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      return;
+    }
+    for (; parts_size != 0 && (size_t)written >= parts->iov_len;
+         ++parts, --parts_size) {
+      written -= parts->iov_len;
+    }
+    if (parts_size != 0) {
+      parts->iov_base = (char *)parts->iov_base + written;
+      parts->iov_len -= written;
+    }
+  }
+}
+
+const char _TUI_TERMINAL_SETUP[] =
+    "\033[?47h"             // switch to the alternate buffer screen
+    "\033[?1000h\033[?1006h";  // mouse tracking with SGR coordinates
+const char _TUI_TERMINAL_RESET[] = "\033[?1006l\033[?1000l\033[?47l";
+
+void _tui_init_sink(TUI_SINK *sink, TUI_SINK_TYPE type, int fd) {
+  sink->type = type;
+  sink->fd = fd;
+  sink->pending = (TUI_BUFFER){0};
+  pthread_mutex_init(&sink->mutex, NULL);
+}
+
+void _tui_delete_sink(TUI_SINK *sink) {
+  pthread_mutex_destroy(&sink->mutex);
+  _tui_delete_buffer(&sink->pending);
+}
+
+void _tui_sink_append(TUI_SINK *sink, const char *data, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  _tui_buffer_reserve(&sink->pending, sink->pending.size + size);
+  memcpy(sink->pending.data + sink->pending.size, data, size);
+  sink->pending.size += size;
+}
+
+void _tui_sink_write(TUI_SINK *sink, const char *data, size_t size) {
+  pthread_mutex_lock(&sink->mutex);
+  _tui_sink_append(sink, data, size);
+  pthread_mutex_unlock(&sink->mutex);
+}
+
+int _tui_sink_printf(TUI_SINK *sink, const char *format, ...) {
+  char text[64];
+  va_list args;
+  va_start(args, format);
+  const int size = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (size < 0 || (size_t)size >= sizeof(text)) {
+    return -1;
+  }
+  _tui_sink_write(sink, text, size);
+  return size;
+}
+
+// Writes what is pending followed by frame with a single system call,
+// returns the number of bytes that went out
+size_t _tui_sink_flush(TUI_SINK *sink, const char *frame, size_t size) {
+  pthread_mutex_lock(&sink->mutex);
+  size_t flushed = size;
+  if (sink->type == TUI_SINK_MEMORY) {
+    _tui_sink_append(sink, frame, size);
+  } else if (sink->pending.size + size != 0) {
+    flushed += sink->pending.size;
+    struct iovec parts[] = {
+        {.iov_base = sink->pending.data, .iov_len = sink->pending.size},
+        {.iov_base = (char *)frame, .iov_len = size},
+    };
+    _tui_write_all(sink->fd, parts, 2);
+    sink->pending.size = 0;
+  }
+  pthread_mutex_unlock(&sink->mutex);
+  return flushed;
+}
+
+struct TUI_ARENA_BLOCK {
+  TUI_ARENA_BLOCK *next;
+  size_t size;
+  size_t used;
+  _Alignas(max_align_t) char data[];
+};
+
+const size_t _TUI_ARENA_BLOCK_SIZE = 64 * 1024;
+
+// the arena that tui_make_* functions allocate from, NULL means the heap
+_Thread_local TUI_ARENA *_tui_active_arena = NULL;
+
+// where measure lays text out, the text widgets keep copies of it
+_Thread_local TUI_TEXT_LAYOUT _tui_text_scratch = {0};
+
+void *_tui_arena_alloc(TUI_ARENA *arena, size_t size) {
+  size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+
+  TUI_ARENA_BLOCK *block = arena->current;
+  while (block != NULL && block->size - block->used < size) {
+    // blocks after the current one are left over from before the last reset
+    block = block->next;
+    if (block != NULL) {
+      block->used = 0;
+      arena->current = block;
+    }
+  }
+
+  if (block == NULL) {
+    size_t block_size = arena->current == NULL ? _TUI_ARENA_BLOCK_SIZE
+                                               : arena->current->size * 2;
+    while (block_size < size) {
+      block_size *= 2;
+    }
+    block = malloc(sizeof(TUI_ARENA_BLOCK) + block_size);
+    block->next = NULL;
+    block->size = block_size;
+    block->used = 0;
+    if (arena->current == NULL) {
+      arena->first = block;
+    } else {
+      arena->current->next = block;
+    }
+    arena->current = block;
+  }
+
+  void *ptr = block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+void _tui_arena_reset(TUI_ARENA *arena) {
+  arena->current = arena->first;
+  if (arena->current != NULL) {
+    arena->current->used = 0;
+  }
+}
+
+void _tui_delete_arena(TUI_ARENA *arena) {
+  TUI_ARENA_BLOCK *block = arena->first;
+  while (block != NULL) {
+    TUI_ARENA_BLOCK *next = block->next;
+    free(block);
+    block = next;
+  }
+  *arena = (TUI_ARENA){0};
+}
+
+// allocates widget memory from the active frame arena if there is one
+void *_tui_widget_alloc(size_t size) {
+  if (_tui_active_arena != NULL) {
+    return _tui_arena_alloc(_tui_active_arena, size);
+  }
+  return malloc(size);
+}
+
+bool _tui_rect_equals(const TUI_RECT *left, const TUI_RECT *right) {
+  return left->width_begin == right->width_begin &&
+         left->width_end == right->width_end &&
+         left->height_begin == right->height_begin &&
+         left->height_end == right->height_end;
+}
+
+bool _tui_rect_is_empty(const TUI_RECT *rect) {
+  return rect->width_begin >= rect->width_end ||
+         rect->height_begin >= rect->height_end;
+}
+
+bool _tui_rect_intersects(const TUI_RECT *left, const TUI_RECT *right) {
+  return left->width_begin < right->width_end &&
+         right->width_begin < left->width_end &&
+         left->height_begin < right->height_end &&
+         right->height_begin < left->height_end;
+}
+
+bool _tui_rect_contains(const TUI_RECT *rect, int x, int y) {
+  return x >= rect->width_begin && x < rect->width_end &&
+         y >= rect->height_begin && y < rect->height_end;
+}
+
+void _tui_rect_add(TUI_RECT *rect, const TUI_RECT *other) {
+  if (_tui_rect_is_empty(other)) {
+    return;
+  } else if (_tui_rect_is_empty(rect)) {
+    *rect = *other;
+    return;
+  }
+  if (other->width_begin < rect->width_begin) {
+    rect->width_begin = other->width_begin;
+  }
+  if (other->width_end > rect->width_end) {
+    rect->width_end = other->width_end;
+  }
+  if (other->height_begin < rect->height_begin) {
+    rect->height_begin = other->height_begin;
+  }
+  if (other->height_end > rect->height_end) {
+    rect->height_end = other->height_end;
+  }
+}
+
+void _tui_rect_clip(TUI_RECT *rect, const TUI_RECT *bounds) {
+  if (rect->width_begin < bounds->width_begin) {
+    rect->width_begin = bounds->width_begin;
+  }
+  if (rect->width_end > bounds->width_end) {
+    rect->width_end = bounds->width_end;
+  }
+  if (rect->height_begin < bounds->height_begin) {
+    rect->height_begin = bounds->height_begin;
+  }
+  if (rect->height_end > bounds->height_end) {
+    rect->height_end = bounds->height_end;
+  }
+}
+
+void _tui_hit_index_clear(TUI_HIT_INDEX *index) {
+  index->targets_size = 0;
+  index->is_built = false;
+}
+
+void _tui_hit_index_add(TUI_HIT_INDEX *index, const TUI_RECT *rect,
+                        ON_CLICK_CALLBACK callback, void *context) {
+  if (_tui_rect_is_empty(rect) || callback == NULL) {
+    return;
+  }
+  if (index->targets_size == index->targets_capacity) {
+    index->targets_capacity =
+        index->targets_capacity == 0 ? 16 : index->targets_capacity * 2;
+    index->targets = realloc(index->targets, index->targets_capacity *
+                                                 sizeof(TUI_HIT_TARGET));
+  }
+  index->targets[index->targets_size++] = (TUI_HIT_TARGET){
+      .rect = *rect, .callback = callback, .context = context};
+  index->is_built = false;
+}
+
+// Appends a span, merging it into the previous one of the same row when they
+// touch and go to the same target
+void _tui_hit_index_push_span(TUI_HIT_INDEX *index, size_t row_spans_begin,
+                              int width_begin, int width_end, size_t target) {
+  if (index->spans_size > row_spans_begin) {
+    TUI_HIT_SPAN *last = &index->spans[index->spans_size - 1];
+    if (last->target == target && last->width_end == width_begin) {
+      last->width_end = width_end;
+      return;
+    }
+  }
+  if (index->spans_size == index->spans_capacity) {
+    index->spans_capacity =
+        index->spans_capacity == 0 ? 64 : index->spans_capacity * 2;
+    index->spans =
+        realloc(index->spans, index->spans_capacity * sizeof(TUI_HIT_SPAN));
+  }
+  index->spans[index->spans_size++] = (TUI_HIT_SPAN){
+      .width_begin = width_begin, .width_end = width_end, .target = target};
+}
+
+int _tui_hit_span_compare(const void *left, const void *right) {
+  const TUI_HIT_SPAN *l = left;
+  const TUI_HIT_SPAN *r = right;
+  if (l->width_begin != r->width_begin) {
+    return l->width_begin < r->width_begin ? -1 : 1;
+  }
+  return l->target < r->target ? -1 : l->target > r->target;
+}
+
+int _tui_int_compare(const void *left, const void *right) {
+  const int l = *(const int *)left;
+  const int r = *(const int *)right;
+  return (l > r) - (l < r);
+}
+
+// Appends the spans of one row given its targets sorted by width_begin
+void _tui_hit_index_resolve_row(TUI_HIT_INDEX *index, TUI_HIT_SPAN *row,
+                                size_t size) {
+  const size_t row_spans_begin = index->spans_size;
+  bool is_overlapping = false;
+  for (size_t i = 1; i < size; ++i) {
+    if (row[i].width_begin < row[i - 1].width_end) {
+      is_overlapping = true;
+      break;
+    }
+  }
+  if (!is_overlapping) {
+    for (size_t i = 0; i < size; ++i) {
+      _tui_hit_index_push_span(index, row_spans_begin, row[i].width_begin,
+                               row[i].width_end, row[i].target);
+    }
+    return;
+  }
+
+  // between each pair of neighbouring edges the last registered target
+  // covering it wins
+  int *edges = malloc(2 * size * sizeof(int));
+  for (size_t i = 0; i < size; ++i) {
+    edges[2 * i] = row[i].width_begin;
+    edges[2 * i + 1] = row[i].width_end;
+  }
+  qsort(edges, 2 * size, sizeof(int), _tui_int_compare);
+  for (size_t e = 0; e + 1 < 2 * size; ++e) {
+    if (edges[e] == edges[e + 1]) {
+      continue;
+    }
+    bool is_covered = false;
+    size_t winner = 0;
+    for (size_t i = 0; i < size && row[i].width_begin <= edges[e]; ++i) {
+      if (row[i].width_end >= edges[e + 1] &&
+          (!is_covered || row[i].target > winner)) {
+        is_covered = true;
+        winner = row[i].target;
+      }
+    }
+    if (is_covered) {
+      _tui_hit_index_push_span(index, row_spans_begin, edges[e], edges[e + 1],
+                               winner);
+    }
+  }
+  free(edges);
+}
+
+void _tui_hit_index_build(TUI_HIT_INDEX *index) {
+  int height = 0;
+  for (size_t i = 0; i < index->targets_size; ++i) {
+    if (index->targets[i].rect.height_end > height) {
+      height = index->targets[i].rect.height_end;
+    }
+  }
+  if ((size_t)height + 1 > index->rows_capacity) {
+    index->rows_capacity = height + 1;
+    index->row_begins =
+        realloc(index->row_begins, index->rows_capacity * sizeof(size_t));
+  }
+  index->height = height;
+
+  // bucket the targets by row, counting first
+  memset(index->row_begins, 0, (height + 1) * sizeof(size_t));
+  for (size_t i = 0; i < index->targets_size; ++i) {
+    const TUI_RECT *rect = &index->targets[i].rect;
+    for (int y = rect->height_begin; y < rect->height_end; ++y) {
+      ++index->row_begins[y + 1];
+    }
+  }
+  for (int y = 0; y < height; ++y) {
+    index->row_begins[y + 1] += index->row_begins[y];
+  }
+  const size_t scratch_size = index->row_begins[height];
+  if (scratch_size > index->scratch_capacity) {
+    index->scratch_capacity = scratch_size;
+    index->scratch =
+        realloc(index->scratch, scratch_size * sizeof(TUI_HIT_SPAN));
+  }
+  for (size_t i = 0; i < index->targets_size; ++i) {
+    const TUI_RECT *rect = &index->targets[i].rect;
+    for (int y = rect->height_begin; y < rect->height_end; ++y) {
+      index->scratch[index->row_begins[y]++] =
+          (TUI_HIT_SPAN){.width_begin = rect->width_begin,
+                         .width_end = rect->width_end,
+                         .target = i};
+    }
+  }
+
+  // row_begins[y] now points at the end of row y, which is where row y + 1
+  // begins in the scratch
+  index->spans_size = 0;
+  size_t row_begin = 0;
+  for (int y = 0; y < height; ++y) {
+    const size_t row_end = index->row_begins[y];
+    TUI_HIT_SPAN *row = index->scratch + row_begin;
+    qsort(row, row_end - row_begin, sizeof(TUI_HIT_SPAN),
+          _tui_hit_span_compare);
+    index->row_begins[y] = index->spans_size;
+    _tui_hit_index_resolve_row(index, row, row_end - row_begin);
+    row_begin = row_end;
+  }
+  index->row_begins[height] = index->spans_size;
+  index->is_built = true;
+}
+
+const TUI_HIT_TARGET *_tui_hit_index_find(TUI_HIT_INDEX *index, int x,
+                                          int y) {
+  if (!index->is_built) {
+    _tui_hit_index_build(index);
+  }
+  if (y < 0 || y >= index->height) {
+    return NULL;
+  }
+  // last span of the row that begins at or before x
+  size_t begin = index->row_begins[y];
+  size_t end = index->row_begins[y + 1];
+  while (begin < end) {
+    const size_t middle = begin + (end - begin) / 2;
+    if (index->spans[middle].width_begin <= x) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  if (begin == index->row_begins[y] || index->spans[begin - 1].width_end <= x) {
+    return NULL;
+  }
+  return &index->targets[index->spans[begin - 1].target];
+}
+
+void _tui_delete_hit_index(TUI_HIT_INDEX *index) {
+  free(index->targets);
+  free(index->row_begins);
+  free(index->spans);
+  free(index->scratch);
+  *index = (TUI_HIT_INDEX){0};
+}
+
+// Palette indices. The ANSI colors are their own index and the 256 colors
+// come after them, RGB colors take the slots after those.
+#define TUI_COLOR_INDEX_INDEXED 8
+#define TUI_COLOR_INDEX_RGB (TUI_COLOR_INDEX_INDEXED + 256)
+#define TUI_COLOR_INDEX_NONE 0xFFFF  // COLOR_NO_COLOR
+// RGB colors a palette holds
+#define TUI_PALETTE_BITS 14
+#define TUI_PALETTE_SIZE (1 << TUI_PALETTE_BITS)
+// slots an RGB color is looked for in before it is drawn as one of the 256
+#define TUI_PALETTE_PROBES 32
+
+// clusters a TUI holds, marks that would need more are not drawn
+#define TUI_CLUSTERS_SIZE 4096
+// slots of the table clusters are found by, twice as many as the clusters
+#define TUI_CLUSTERS_TABLE_BITS 13
+
+const TERMINAL_CELL _TUI_EMPTY_CELL = {
+    .text = ' ',
+    .color = TUI_COLOR_INDEX_NONE,
+    .background_color = TUI_COLOR_INDEX_NONE,
+};
+
+// the second cell of a wide character has no text of its own
+bool _tui_is_continuation(const TERMINAL_CELL *cell) {
+  return cell->text == 0;
+}
+
+size_t _tui_cluster_size(const TUI_CLUSTER *cluster) {
+  const char *end = memchr(cluster->text, '\0', sizeof(cluster->text));
+  return end == NULL ? sizeof(cluster->text) : (size_t)(end - cluster->text);
+}
+
+// the UTF-8 of the text of cell
+TUI_CLUSTER _tui_cell_cluster(const TERMINAL_CELL *cell,
+                              const TUI_CLUSTERS *clusters) {
+  if (cell->text & TUI_CELL_CLUSTER) {
+    return clusters->clusters[cell->text & ~TUI_CELL_CLUSTER];
+  }
+  TUI_CLUSTER cluster = {0};
+  if (cell->text != 0) {
+    _tui_encode_utf8(cluster.text, cell->text);
+  }
+  return cluster;
+}
+
+// Finds the index of cluster, which is added if it is new. False if all of
+// the clusters are taken.
+bool _tui_add_cluster(TUI_CLUSTERS *clusters, const TUI_CLUSTER *cluster,
+                      uint32_t *index) {
+  const size_t table_size = 1 << TUI_CLUSTERS_TABLE_BITS;
+  uint64_t word;
+  memcpy(&word, cluster->text, sizeof(word));
+  bool is_found = false;
+  pthread_mutex_lock(&clusters->mutex);
+  if (clusters->clusters == NULL) {
+    clusters->clusters = malloc(TUI_CLUSTERS_SIZE * sizeof(TUI_CLUSTER));
+    clusters->table = calloc(table_size, sizeof(int));
+  }
+  // the table is at most half full, so there is always a free slot
+  for (size_t i = (word * 0x9E3779B97F4A7C15ULL) >>
+                  (64 - TUI_CLUSTERS_TABLE_BITS);
+       ; i = (i + 1) % table_size) {
+    const int found = clusters->table[i];
+    if (found == 0) {
+      if (clusters->size < TUI_CLUSTERS_SIZE) {
+        clusters->clusters[clusters->size] = *cluster;
+        *index = clusters->size++;
+        clusters->table[i] = clusters->size;
+        is_found = true;
+      }
+      break;
+    } else if (memcmp(clusters->clusters[found - 1].text, cluster->text,
+                      sizeof(cluster->text)) == 0) {
+      *index = found - 1;
+      is_found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&clusters->mutex);
+  return is_found;
+}
+
+void _tui_delete_clusters(TUI_CLUSTERS *clusters) {
+  pthread_mutex_destroy(&clusters->mutex);
+  free(clusters->clusters);
+  free(clusters->table);
+  *clusters = (TUI_CLUSTERS){0};
+}
+
+// Before the cells [begin, end) of row are drawn over, the halves of wide
+// characters outside of them that lose their other half become spaces, as
+// the terminal erases all of a wide character that is partly overwritten.
+void _tui_break_wide_chars(TERMINAL_CELL *row, int width, int begin,
+                           int end) {
+  if (begin > 0 && _tui_is_continuation(row + begin)) {
+    row[begin - 1].text = ' ';
+  }
+  if (end < width && _tui_is_continuation(row + end)) {
+    row[end].text = ' ';
+  }
+}
+
+void _tui_fill_cells(TERMINAL_CELL *cells, size_t count) {
+  _tui_cell_kernels.fill(cells, _TUI_EMPTY_CELL, count);
+}
 
 void _tui_clear_cells(TUI *tui) {
-  const TERMINAL_CELL empty = {.c = ' ',
-                               .color = COLOR_NO_COLOR,
-                               .background_color = COLOR_NO_COLOR,
-                               .on_click_callback = NULL};
-  for (size_t i = 0; i < tui->cells_length; ++i) {
-    tui->cells[i] = empty;
+  _tui_fill_cells(tui->cells, tui->cells_length);
+  _tui_hit_index_clear(&tui->hit_index);
+  _tui_hit_index_clear(&tui->scroll_index);
+}
+
+void _tui_clear_cells_in_rect(TUI *tui, const TUI_RECT *rect) {
+  const int width = tui_get_width(tui);
+  for (int y = rect->height_begin; y < rect->height_end; ++y) {
+    TERMINAL_CELL *const row = tui->cells + (size_t)y * width;
+    _tui_break_wide_chars(row, width, rect->width_begin, rect->width_end);
+    _tui_fill_cells(row + rect->width_begin,
+                    rect->width_end - rect->width_begin);
   }
 }
 
 void _tui_init_cells(TUI *tui) {
   tui->cells_length = tui_get_width(tui) * tui_get_height(tui);
-  tui->cells = malloc(tui->cells_length * sizeof(TERMINAL_CELL));
+  tui->cells_capacity = tui->cells_length;
+  tui->cells = malloc(tui->cells_capacity * sizeof(TERMINAL_CELL));
+  tui->front_cells = malloc(tui->cells_capacity * sizeof(TERMINAL_CELL));
+  tui->front_cells_valid = false;
+  tui->exposed = (TUI_RECT){0};
   _tui_clear_cells(tui);
 }
 
+// Resizes the cells to the current size keeping what was drawn where it was
+// on the screen. Memory is only reallocated to grow, geometrically.
+void _tui_resize_cells(TUI *tui, int old_width, int old_height) {
+  const int width = tui_get_width(tui);
+  const int height = tui_get_height(tui);
+  tui->cells_length = (size_t)width * height;
+
+  if (tui->cells_length > tui->cells_capacity) {
+    size_t capacity = tui->cells_capacity * 2;
+    if (capacity < tui->cells_length) {
+      capacity = tui->cells_length;
+    }
+    tui->cells = realloc(tui->cells, capacity * sizeof(TERMINAL_CELL));
+    free(tui->front_cells);
+    tui->front_cells = malloc(capacity * sizeof(TERMINAL_CELL));
+    tui->cells_capacity = capacity;
+  }
+
+  const int kept_width = width < old_width ? width : old_width;
+  const int kept_height = height < old_height ? height : old_height;
+  // move rows in the order that never overwrites a row not yet moved
+  for (int i = 0; i < kept_height; ++i) {
+    const int y = width > old_width ? kept_height - 1 - i : i;
+    TERMINAL_CELL *row = tui->cells + (size_t)y * width;
+    const TERMINAL_CELL *old_row = tui->cells + (size_t)y * old_width;
+    // a wide character cut in half by the new right edge can't be drawn
+    const bool is_cut = kept_width > 0 && kept_width < old_width &&
+                        _tui_is_continuation(old_row + kept_width);
+    memmove(row, old_row, kept_width * sizeof(TERMINAL_CELL));
+    if (is_cut) {
+      row[kept_width - 1].text = ' ';
+    }
+    _tui_fill_cells(row + kept_width, width - kept_width);
+  }
+  const size_t kept_end = (size_t)kept_height * width;
+  _tui_fill_cells(tui->cells + kept_end, tui->cells_length - kept_end);
+
+  // the terminal may have reflowed or cleared, so repaint it all once
+  tui->front_cells_valid = false;
+
+  if (width > old_width) {
+    const TUI_RECT right = {old_width, width, 0, kept_height};
+    _tui_rect_add(&tui->exposed, &right);
+  }
+  if (height > old_height) {
+    const TUI_RECT bottom = {0, width, old_height, height};
+    _tui_rect_add(&tui->exposed, &bottom);
+  }
+}
+
 void _tui_delete_cells(TUI *tui) {
   tui->cells_length = 0;
+  tui->cells_capacity = 0;
   free(tui->cells);
   tui->cells = NULL;
+  free(tui->front_cells);
+  tui->front_cells = NULL;
+  tui->front_cells_valid = false;
+}
+
+unsigned int _tui_detect_terminal_features() {
+  const struct {
+    const char *prefix;
+    unsigned int features;
+  } terminals[] = {
+      {"xterm", TUI_FEATURE_REP | TUI_FEATURE_BCE},  // also kitty and VTE
+      {"alacritty", TUI_FEATURE_REP | TUI_FEATURE_BCE},
+      {"foot", TUI_FEATURE_REP | TUI_FEATURE_BCE},
+      {"wezterm", TUI_FEATURE_REP | TUI_FEATURE_BCE},
+      {"tmux", TUI_FEATURE_REP},
+      {"linux", TUI_FEATURE_BCE},
+  };
+  unsigned int features = 0;
+  const char *term = getenv("TERM");
+  if (term != NULL) {
+    for (size_t i = 0; i < sizeof(terminals) / sizeof(*terminals); ++i) {
+      if (strncmp(term, terminals[i].prefix, strlen(terminals[i].prefix)) ==
+          0) {
+        features = terminals[i].features;
+        break;
+      }
+    }
+    if (strstr(term, "256color") != NULL) {
+      features |= TUI_FEATURE_256_COLORS;
+    }
+  }
+  // terminals with RGB colors announce it here, TERM stays xterm-256color
+  const char *colorterm = getenv("COLORTERM");
+  if (colorterm != NULL && (strcmp(colorterm, "truecolor") == 0 ||
+                            strcmp(colorterm, "24bit") == 0)) {
+    features |= TUI_FEATURE_256_COLORS | TUI_FEATURE_TRUECOLOR;
+  }
+  return features;
+}
+
+void tui_set_terminal_features(TUI *tui, unsigned int features) {
+  tui->terminal_features = features;
+}
+
+COLOR tui_color_indexed(uint8_t index) { return COLOR_INDEXED | index; }
+
+COLOR tui_color_rgb(uint8_t red, uint8_t green, uint8_t blue) {
+  return COLOR_RGB | red << 16 | green << 8 | blue;
 }
 
 TUI *tui_init() {
-  setbuf(stdout, NULL);
+  _tui_select_cell_kernels();
+  _tui_build_color_tables();
+  _tui_build_width_table();
 
   TUI *tui = malloc(sizeof(TUI));
+  tui->size = (struct winsize){0};
+  tui->output = (TUI_BUFFER){0};
+  tui->row_hashes = (TUI_ROW_HASHES){0};
+  _tui_init_sink(&tui->sink, TUI_SINK_FD, STDOUT_FILENO);
+  tui->terminal_features = _tui_detect_terminal_features();
+  tui->palette.rgb_colors = calloc(TUI_PALETTE_SIZE, sizeof(atomic_uint));
+  tui->clusters = (TUI_CLUSTERS){0};
+  pthread_mutex_init(&tui->clusters.mutex, NULL);
+  tui->hit_index = (TUI_HIT_INDEX){0};
+  tui->scroll_index = (TUI_HIT_INDEX){0};
+  tui->workers = (TUI_WORKERS){0};
+  tui->pipeline = (TUI_PIPELINE){0};
+  memset(&tui->stats, 0, sizeof(tui->stats));
+  tui->root_widget = NULL;
+  tui->use_frame_arena = false;
+  tui->frame_arenas[0] = (TUI_ARENA){0};
+  tui->frame_arenas[1] = (TUI_ARENA){0};
+  tui->root_widget_arena = NULL;
+  tui->input = (TUI_INPUT){0};
+  tui->timer_interval = 0;
+  tui->timer_deadline = 0;
+
+  // the main loop sleeps on this pipe, signals and other threads write to
+  // it to wake the loop up. Without it the loop runs at a fixed rate.
+  if (pipe(tui->wake_pipe) == 0) {
+    for (int i = 0; i < 2; ++i) {
+      fcntl(tui->wake_pipe[i], F_SETFL,
+            fcntl(tui->wake_pipe[i], F_GETFL) | O_NONBLOCK);
+      fcntl(tui->wake_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+  } else {
+    tui->wake_pipe[0] = -1;
+    tui->wake_pipe[1] = -1;
+  }
+  _tui_add_live_tui(tui);
 
   tui_get_cursor_pos(tui, &tui->init_cursor_x, &tui->init_cursor_y);
 
@@ -54,39 +806,68 @@ TUI *tui_init() {
   cfmakeraw(&tui->raw);
   tcsetattr(STDIN_FILENO, TCSANOW, &tui->raw);
 
-  // Switch to the alternate buffer screen
-  write(STDOUT_FILENO, "\e[?47h", 6);
-
-  // Enable mouse tracking
-  write(STDOUT_FILENO, "\e[?9h", 5);
+  _tui_sink_flush(&tui->sink, _TUI_TERMINAL_SETUP,
+                  sizeof(_TUI_TERMINAL_SETUP) - 1);
 
   _tui_init_cells(tui);
 
+  // a TUI made after another one must still ask for its size
+  _tui_is_resize_pending = 1;
   tui_refresh(tui);
   return tui;
 }
 
 void tui_delete(TUI *restrict tui) {
+  _tui_stop_output_thread(tui);
+
   // Revert the terminal back to its original state
-  write(STDOUT_FILENO, "\e[?9l", 5);
-  write(STDOUT_FILENO, "\e[?47l", 6);
+  _tui_sink_write(&tui->sink, _TUI_TERMINAL_RESET,
+                  sizeof(_TUI_TERMINAL_RESET) - 1);
   tcsetattr(STDIN_FILENO, TCSANOW, &tui->original);
 
-  tui_move_to(tui->init_cursor_x, tui->init_cursor_y);
+  tui_move_to(tui, tui->init_cursor_x, tui->init_cursor_y);
+  _tui_sink_flush(&tui->sink, NULL, 0);
+
+  _tui_remove_live_tui(tui);
+  if (tui->wake_pipe[0] != -1) {
+    close(tui->wake_pipe[0]);
+    close(tui->wake_pipe[1]);
+  }
 
+  tui_delete_widget(tui->root_widget);
+  _tui_delete_arena(&tui->frame_arenas[0]);
+  _tui_delete_arena(&tui->frame_arenas[1]);
   _tui_delete_cells(tui);
+  free(tui->palette.rgb_colors);
+  _tui_delete_clusters(&tui->clusters);
+  _tui_delete_hit_index(&tui->hit_index);
+  _tui_delete_hit_index(&tui->scroll_index);
+  _tui_delete_text_layout(&_tui_text_scratch);
+  _tui_stop_workers(tui);
+  _tui_delete_row_hashes(&tui->row_hashes);
+  _tui_delete_buffer(&tui->output);
+  _tui_delete_sink(&tui->sink);
   free(tui);
 }
 
 void tui_refresh(TUI *tui) {
+  if (!_tui_is_resize_pending) {
+    return;
+  }
+  // cleared before asking so a resize during the ioctl is not lost
+  _tui_is_resize_pending = 0;
+
   const int width = tui_get_width(tui);
   const int height = tui_get_height(tui);
 
-  ioctl(STDOUT_FILENO, TIOCGWINSZ, &tui->size);
+  // a memory sink or a socket has no size, the terminal's is used then
+  if (tui->sink.type != TUI_SINK_FD ||
+      ioctl(tui->sink.fd, TIOCGWINSZ, &tui->size) != 0) {
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &tui->size);
+  }
 
   if (width != tui_get_width(tui) || height != tui_get_height(tui)) {
-    _tui_delete_cells(tui);
-    _tui_init_cells(tui);
+    _tui_resize_cells(tui, width, height);
   }
 }
 
@@ -94,19 +875,31 @@ int tui_get_width(TUI *tui) { return tui->size.ws_col; }
 
 int tui_get_height(TUI *tui) { return tui->size.ws_row; }
 
-int tui_clear_screen() { return printf("\033[2J\r"); }
+int tui_clear_screen(TUI *tui) {
+  return _tui_sink_printf(&tui->sink, "\033[2J\r");
+}
 
-int tui_move_top(int n) { return printf("\033[%dA", n); }
+int tui_move_top(TUI *tui, int n) {
+  return _tui_sink_printf(&tui->sink, "\033[%dA", n);
+}
 
-int tui_move_up(int n) { return printf("\033[%dB", n); }
+int tui_move_up(TUI *tui, int n) {
+  return _tui_sink_printf(&tui->sink, "\033[%dB", n);
+}
 
-int tui_move_right(int n) { return printf("\033[%dC", n); }
+int tui_move_right(TUI *tui, int n) {
+  return _tui_sink_printf(&tui->sink, "\033[%dC", n);
+}
 
-int tui_move_left(int n) { return printf("\033[%dD", n); }
+int tui_move_left(TUI *tui, int n) {
+  return _tui_sink_printf(&tui->sink, "\033[%dD", n);
+}
 
-int tui_save_cursor() { return printf("\0337"); }
+int tui_save_cursor(TUI *tui) { return _tui_sink_printf(&tui->sink, "\0337"); }
 
-int tui_restore_cursor() { return printf("\0338"); }
+int tui_restore_cursor(TUI *tui) {
+  return _tui_sink_printf(&tui->sink, "\0338");
+}
 
 void tui_get_cursor_pos(TUI *tui, int *x, int *y) {
   char buf[8];
@@ -114,8 +907,9 @@ void tui_get_cursor_pos(TUI *tui, int *x, int *y) {
   tcgetattr(0, &tui->raw);
   cfmakeraw(&tui->helper);
   tcsetattr(0, TCSANOW, &tui->helper);
-  if (isatty(fileno(stdin))) {
-    write(STDOUT_FILENO, cmd, sizeof(cmd));
+  // only a terminal answers, and it answers on stdin
+  if (isatty(fileno(stdin)) && tui->sink.type == TUI_SINK_FD) {
+    _tui_sink_flush(&tui->sink, cmd, sizeof(cmd) - 1);
     read(STDIN_FILENO, buf, sizeof(buf));
 
     sscanf(buf, "\033[%d;%dR", y, x);
@@ -125,26 +919,105 @@ void tui_get_cursor_pos(TUI *tui, int *x, int *y) {
   tcsetattr(0, TCSANOW, &tui->raw);
 }
 
-int tui_move_to(int x, int y) { return printf("\033[%d;%dH", y + 1, x + 1); }
+int tui_move_to(TUI *tui, int x, int y) {
+  return _tui_sink_printf(&tui->sink, "\033[%d;%dH", y + 1, x + 1);
+}
 
-int tui_delete_before() { return printf("\b \b"); }
+int tui_delete_before(TUI *tui) {
+  return _tui_sink_printf(&tui->sink, "\b \b");
+}
 
-int tui_delete_under_cursor() { return printf(" \b"); }
+int tui_delete_under_cursor(TUI *tui) {
+  return _tui_sink_printf(&tui->sink, " \b");
+}
 
 int _tui_get_cell_index(TUI *tui, int x, int y) {
   const int width = tui_get_width(tui);
   return x + width * y;
 }
 
-void _tui_set_cell_char(TUI *tui, int x, int y, char c) {
-  tui->cells[_tui_get_cell_index(tui, x, y)].c = c;
+// Clips the cells [x, x + size) of row y to clip, false if none are left
+bool _tui_clip_cells(const TUI_RECT *clip, int x, int y, int size,
+                     int *begin, int *end) {
+  if (y < clip->height_begin || y >= clip->height_end) {
+    return false;
+  }
+  *begin = x < clip->width_begin ? clip->width_begin : x;
+  *end = x + size > clip->width_end ? clip->width_end : x + size;
+  return *begin < *end;
+}
+
+// draws the ASCII characters of text from x on row y inside of clip with the
+// color of the palette index, TUI_COLOR_INDEX_NONE keeps the cells' colors
+void _tui_draw_ascii(TUI *tui, const TUI_RECT *clip, int x, int y,
+                     const char *text, int size, uint16_t color) {
+  int begin, end;
+  if (!_tui_clip_cells(clip, x, y, size, &begin, &end)) {
+    return;
+  }
+  const int width = tui_get_width(tui);
+  TERMINAL_CELL *const row = tui->cells + (size_t)y * width;
+  _tui_break_wide_chars(row, width, begin, end);
+  for (int i = begin; i < end; ++i) {
+    if (color != TUI_COLOR_INDEX_NONE) {
+      row[i].color = color;
+    }
+    row[i].text = (unsigned char)text[i - x];
+  }
+}
+
+// Draws a character of the given number of columns at x on row y if any of
+// it is inside of clip. All of a wide character is drawn so its halves stay
+// together, the cells after its first one are left without text.
+void _tui_draw_char(TUI *tui, const TUI_RECT *clip, int x, int y,
+                    uint32_t codepoint, int columns, uint16_t color) {
+  if (y < clip->height_begin || y >= clip->height_end ||
+      x + columns <= clip->width_begin || x >= clip->width_end) {
+    return;
+  }
+  const int width = tui_get_width(tui);
+  if (x + columns > width) {  // cut off by the right edge of the screen
+    codepoint = ' ';
+    columns = width - x;
+  }
+  TERMINAL_CELL *const row = tui->cells + (size_t)y * width;
+  _tui_break_wide_chars(row, width, x, x + columns);
+  for (int i = x; i < x + columns; ++i) {
+    if (color != TUI_COLOR_INDEX_NONE) {
+      row[i].color = color;
+    }
+    row[i].text = i == x ? codepoint : 0;
+  }
+}
+
+// adds a combining mark to the character at x on row y if it is inside of
+// clip and there is room for it
+void _tui_combine_char(TUI *tui, const TUI_RECT *clip, int x, int y,
+                       uint32_t mark) {
+  if (!_tui_rect_contains(clip, x, y)) {
+    return;
+  }
+  TERMINAL_CELL *const cell = &tui->cells[_tui_get_cell_index(tui, x, y)];
+  if (_tui_is_continuation(cell)) {
+    return;
+  }
+  TUI_CLUSTER cluster = _tui_cell_cluster(cell, &tui->clusters);
+  const size_t size = _tui_cluster_size(&cluster);
+  uint32_t index;
+  if (size + _tui_utf8_size(mark) <= sizeof(cluster.text)) {
+    _tui_encode_utf8(cluster.text + size, mark);
+    if (_tui_add_cluster(&tui->clusters, &cluster, &index)) {
+      cell->text = TUI_CELL_CLUSTER | index;
+    }
+  }
 }
 
 void _tui_set_cell_color(TUI *tui, int x, int y, COLOR color) {
   if (color == COLOR_NO_COLOR) {
     return;
   }
-  tui->cells[_tui_get_cell_index(tui, x, y)].color = color;
+  tui->cells[_tui_get_cell_index(tui, x, y)].color =
+      _tui_color_index(&tui->palette, color);
 }
 
 void _tui_set_cell_background_color(TUI *tui, int x, int y,
@@ -153,421 +1026,2732 @@ void _tui_set_cell_background_color(TUI *tui, int x, int y,
     return;
   }
   tui->cells[_tui_get_cell_index(tui, x, y)].background_color =
-      background_color;
+      _tui_color_index(&tui->palette, background_color);
 }
 
+// sets the background to the palette index unless the cell has one already
 void _tui_set_cell_background_color_if_not_set(TUI *tui, int x, int y,
-                                               COLOR background_color) {
-  if (background_color == COLOR_NO_COLOR) {
-    return;
-  }
+                                               uint16_t background_color) {
   TERMINAL_CELL *cell = &tui->cells[_tui_get_cell_index(tui, x, y)];
-  if (cell->background_color == COLOR_NO_COLOR) {
+  if (cell->background_color == TUI_COLOR_INDEX_NONE) {
     cell->background_color = background_color;
   }
 }
 
-void _tui_set_cell_on_click_callback(TUI *tui, int x, int y,
-                                     ON_CLICK_CALLBACK on_click_callback) {
-  tui->cells[_tui_get_cell_index(tui, x, y)].on_click_callback =
-      on_click_callback;
-}
-
 void tui_handle_mouse_action(TUI *tui, const MOUSE_ACTION *mouse_action) {
-  const ON_CLICK_CALLBACK callback =
-      tui->cells[_tui_get_cell_index(tui, mouse_action->x, mouse_action->y)]
-          .on_click_callback;
-  if (callback != NULL) {
-    callback(mouse_action);
+  if (mouse_action->x >= (unsigned int)tui_get_width(tui) ||
+      mouse_action->y >= (unsigned int)tui_get_height(tui)) {
+    return;
+  }
+  const TUI_HIT_TARGET *target = NULL;
+  // the wheel scrolls the innermost scroll view even over a button in it
+  if (mouse_action->button == MOUSE_BUTTON_SCROLL_UP ||
+      mouse_action->button == MOUSE_BUTTON_SCROLL_DOWN) {
+    target = _tui_hit_index_find(&tui->scroll_index, mouse_action->x,
+                                 mouse_action->y);
+  }
+  if (target == NULL) {
+    target = _tui_hit_index_find(&tui->hit_index, mouse_action->x,
+                                 mouse_action->y);
+  }
+  if (target != NULL) {
+    target->callback(mouse_action, target->context);
   }
 }
 
-int tui_change_terminal_text_color(COLOR color) {
+int tui_change_terminal_text_color(TUI *tui, COLOR color) {
   if (color == COLOR_NO_COLOR) {
     return 0;
   } else if (color == COLOR_RESET) {
-    return printf("\033[%dm", COLOR_RESET);
+    return _tui_sink_printf(&tui->sink, "\033[%dm", COLOR_RESET);
   }
-  return printf("\033[%dm", color + 30);
+  return _tui_sink_printf(&tui->sink, "\033[%dm", color + 30);
 }
 
-int tui_change_terminal_background_color(COLOR color) {
+int tui_change_terminal_background_color(TUI *tui, COLOR color) {
   if (color == COLOR_NO_COLOR) {
     return 0;
   } else if (color == COLOR_RESET) {
-    return printf("\033[%dm", COLOR_RESET);
+    return _tui_sink_printf(&tui->sink, "\033[%dm", COLOR_RESET);
   }
-  return printf("\033[%dm", color + 40);
+  return _tui_sink_printf(&tui->sink, "\033[%dm", color + 40);
 }
 
-bool handle_input(TUI *tui) {
-  unsigned char buff[6];
-  read(STDIN_FILENO, &buff, 1);
-  if (buff[0] == 3) {  // User pressd Ctr+C
-    return true;
-  } else if (buff[0] == '\x1B') {  // [ESCAPE]
-    // TODO: fix for inputting actual <ESC>
-    read(STDIN_FILENO, &buff, 5);
-    switch (buff[1]) {
-      case 77: {
-        const MOUSE_ACTION mouse_action = {
-            .button = buff[2],
-            .x = buff[3] - 32 - 1,  // starts at 0
-            .y = buff[4] - 32 - 1,  // starts at 0
-        };
-        tui_handle_mouse_action(tui, &mouse_action);
-        /*printf("button:%u\n\rx:%u\n\ry:%u\n\n\r", mouse_action.button,*/
-        /*       mouse_action.x, mouse_action.y);*/
-      } break;
+const int NANO_TO_SECOND = 1000000000;
+
+int64_t nano_sleep(long int nano_seconds) {
+  if (nano_seconds <= 0) {
+    return 0;
+  }
+  struct timespec remaining = {0, 0},
+      request = {nano_seconds / NANO_TO_SECOND, nano_seconds % NANO_TO_SECOND};
+  nanosleep(&request, &remaining);
+  return remaining.tv_sec * NANO_TO_SECOND + remaining.tv_nsec;
+}
+
+long int nano_time() {
+  struct timespec t = {0, 0}, tend = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * NANO_TO_SECOND + t.tv_nsec;
+}
+
+// widget nodes made on this thread, for TUI_COUNTER_WIDGETS_ALLOCATED
+_Thread_local uint64_t _tui_widgets_allocated = 0;
+
+void _tui_stat_add(TUI_STAT *stat, uint64_t value) {
+  atomic_fetch_add_explicit(&stat->pending, value, memory_order_relaxed);
+}
+
+// Adds the time since start to stage and returns the current time
+long int _tui_stage_end(TUI_STATS *stats, TUI_STAGE stage, long int start) {
+  const long int now = nano_time();
+  _tui_stat_add(&stats->stages[stage], now - start);
+  return now;
+}
+
+void _tui_stat_end_frame(TUI_STAT *stat) {
+  const uint64_t value =
+      atomic_exchange_explicit(&stat->pending, 0, memory_order_relaxed);
+  stat->samples[stat->head] = value;
+  stat->head = (stat->head + 1) % TUI_STAT_WINDOW;
+  if (stat->size < TUI_STAT_WINDOW) {
+    ++stat->size;
+  }
+  stat->total += value;
+}
+
+void _tui_stats_end_frame(TUI_STATS *stats) {
+  for (int i = 0; i < TUI_STAGE_COUNT; ++i) {
+    _tui_stat_end_frame(&stats->stages[i]);
+  }
+  for (int i = 0; i < TUI_COUNTER_COUNT; ++i) {
+    _tui_stat_end_frame(&stats->counters[i]);
+  }
+  ++stats->frames;
+}
+
+int _tui_uint64_compare(const void *left, const void *right) {
+  const uint64_t l = *(const uint64_t *)left;
+  const uint64_t r = *(const uint64_t *)right;
+  return (l > r) - (l < r);
+}
+
+TUI_STAT_SUMMARY _tui_stat_summary(const TUI_STAT *stat) {
+  TUI_STAT_SUMMARY summary = {.total = stat->total};
+  if (stat->size == 0) {
+    return summary;
+  }
+  uint64_t sorted[TUI_STAT_WINDOW];
+  memcpy(sorted, stat->samples, stat->size * sizeof(uint64_t));
+  qsort(sorted, stat->size, sizeof(uint64_t), _tui_uint64_compare);
+  summary.last =
+      stat->samples[(stat->head + TUI_STAT_WINDOW - 1) % TUI_STAT_WINDOW];
+  summary.p50 = sorted[(stat->size - 1) * 50 / 100];
+  summary.p99 = sorted[(stat->size - 1) * 99 / 100];
+  summary.max = sorted[stat->size - 1];
+  return summary;
+}
+
+TUI_STAT_SUMMARY tui_get_stage_stats(TUI *tui, TUI_STAGE stage) {
+  return _tui_stat_summary(&tui->stats.stages[stage]);
+}
+
+TUI_STAT_SUMMARY tui_get_counter_stats(TUI *tui, TUI_COUNTER counter) {
+  return _tui_stat_summary(&tui->stats.counters[counter]);
+}
+
+const char *const _TUI_STAGE_NAMES[TUI_STAGE_COUNT] = {
+    "input", "build", "layout", "rasterize", "encode", "write", "sleep",
+};
+
+const char *const _TUI_COUNTER_NAMES[TUI_COUNTER_COUNT] = {
+    "bytes",
+    "cells",
+    "widgets",
+};
+
+bool tui_dump_stats(TUI *tui, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  fprintf(file, "name\tunit\tlast\tp50\tp99\tmax\ttotal\n");
+  for (int i = 0; i < TUI_STAGE_COUNT; ++i) {
+    const TUI_STAT_SUMMARY summary = tui_get_stage_stats(tui, i);
+    fprintf(file,
+            "%s\tns\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+            "\t%" PRIu64 "\n",
+            _TUI_STAGE_NAMES[i], summary.last, summary.p50, summary.p99,
+            summary.max, summary.total);
+  }
+  for (int i = 0; i < TUI_COUNTER_COUNT; ++i) {
+    const TUI_STAT_SUMMARY summary = tui_get_counter_stats(tui, i);
+    fprintf(file,
+            "%s\tcount\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+            "\t%" PRIu64 "\n",
+            _TUI_COUNTER_NAMES[i], summary.last, summary.p50, summary.p99,
+            summary.max, summary.total);
+  }
+  fprintf(file, "frames\tcount\t\t\t\t\t%" PRIu64 "\n", tui->stats.frames);
+  return fclose(file) == 0;
+}
+
+int kbhit() {
+  struct timeval tv = {0L, 0L};
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(0, &fds);
+  return select(1, &fds, NULL, NULL, &tv) > 0;
+}
+
+// how long a lone ESC waits for the rest of an escape sequence
+const int64_t _TUI_ESCAPE_TIMEOUT = 25 * 1000 * 1000;
+
+unsigned char _tui_input_peek(const TUI_INPUT *input, size_t i) {
+  return input->data[(input->head + i) % sizeof(input->data)];
+}
+
+void _tui_input_consume(TUI_INPUT *input, size_t size) {
+  input->head = (input->head + size) % sizeof(input->data);
+  input->size -= size;
+}
+
+// reads whatever is available on stdin into the ring buffer without blocking
+void _tui_input_fill(TUI_INPUT *input) {
+  while (input->size < sizeof(input->data) && kbhit()) {
+    const size_t tail = (input->head + input->size) % sizeof(input->data);
+    const size_t free_space = sizeof(input->data) - input->size;
+    const size_t contiguous = sizeof(input->data) - tail;
+    const size_t wanted = free_space < contiguous ? free_space : contiguous;
+    const ssize_t size = read(STDIN_FILENO, input->data + tail, wanted);
+    if (size <= 0) {
+      return;
+    }
+    input->size += size;
+  }
+}
+
+// parses unsigned decimal parameters separated by ';' of a CSI sequence
+// starting at begin and ending before end
+int _tui_input_parse_params(const TUI_INPUT *input, size_t begin, size_t end,
+                            unsigned int *params, int max_params) {
+  int count = 0;
+  unsigned int value = 0;
+  for (size_t i = begin; i < end; ++i) {
+    const unsigned char c = _tui_input_peek(input, i);
+    if (c >= '0' && c <= '9') {
+      value = value * 10 + (c - '0');
+    } else if (c == ';') {
+      if (count < max_params) {
+        params[count++] = value;
+      }
+      value = 0;
+    }
+  }
+  if (count < max_params) {
+    params[count++] = value;
+  }
+  return count;
+}
+
+const unsigned int _TUI_MOUSE_MODIFIERS =
+    MOUSE_MODIFIER_SHIFT | MOUSE_MODIFIER_META | MOUSE_MODIFIER_CONTROL;
+
+MOUSE_BUTTON _tui_mouse_button_from_code(unsigned int code) {
+  if (code & 32) {
+    return MOUSE_BUTTON_MOVE;
+  }
+  return (code & ~_TUI_MOUSE_MODIFIERS) + 32;
+}
+
+// Decodes the next event in the buffer. Returns the bytes it took, or 0 when
+// the buffer ends in the middle of an escape sequence.
+size_t _tui_input_decode(TUI_INPUT *input, bool is_timed_out,
+                         TUI_EVENT *event) {
+  const unsigned char c = _tui_input_peek(input, 0);
+  *event = (TUI_EVENT){.type = TUI_EVENT_KEY, .key = c};
+  if (c != '\x1B') {
+    return 1;
+  } else if (input->size == 1) {
+    return is_timed_out ? 1 : 0;
+  }
+
+  const unsigned char introducer = _tui_input_peek(input, 1);
+  if (introducer != '[') {
+    // ESC followed by a key is the ESC key and then that key
+    return 1;
+  } else if (input->size < 3) {
+    return is_timed_out ? 1 : 0;
+  }
+
+  if (_tui_input_peek(input, 2) == 'M') {  // X10 mouse, three raw bytes
+    if (input->size < 6) {
+      return is_timed_out ? 1 : 0;
+    }
+    const unsigned int code = _tui_input_peek(input, 3) - 32;
+    *event = (TUI_EVENT){
+        .type = TUI_EVENT_MOUSE,
+        .mouse = {.button = _tui_mouse_button_from_code(code),
+                  .modifiers = code & _TUI_MOUSE_MODIFIERS,
+                  .x = _tui_input_peek(input, 4) - 32 - 1,  // starts at 0
+                  .y = _tui_input_peek(input, 5) - 32 - 1,
+                  .count = 1},
+    };
+    if ((code & 3) == 3 && !(code & 64)) {  // X10 release
+      event->type = TUI_EVENT_NONE;
+    }
+    return 6;
+  }
+
+  // CSI: parameters and intermediates up to a final byte
+  const size_t max_size = 32;
+  size_t end = 2;
+  while (end < input->size && end < max_size) {
+    const unsigned char b = _tui_input_peek(input, end);
+    if (b >= 0x40 && b <= 0x7E) {
+      break;
     }
+    ++end;
+  }
+  if (end == input->size) {
+    return is_timed_out ? 1 : 0;
+  } else if (end == max_size) {
+    return 1;  // garbage, drop the ESC
+  }
+
+  const unsigned char final = _tui_input_peek(input, end);
+  unsigned int params[3] = {0, 0, 0};
+  if (_tui_input_peek(input, 2) == '<' && (final == 'M' || final == 'm')) {
+    // SGR (1006) mouse, decimal so it works past column 223
+    _tui_input_parse_params(input, 3, end, params, 3);
+    *event = (TUI_EVENT){
+        .type = final == 'M' ? TUI_EVENT_MOUSE : TUI_EVENT_NONE,
+        .mouse = {.button = _tui_mouse_button_from_code(params[0]),
+                  .modifiers = params[0] & _TUI_MOUSE_MODIFIERS,
+                  .x = params[1] - 1,
+                  .y = params[2] - 1,
+                  .count = 1},
+    };
+  } else if (final == 'R') {  // cursor position report
+    _tui_input_parse_params(input, 2, end, params, 2);
+    *event = (TUI_EVENT){
+        .type = TUI_EVENT_CURSOR_POSITION,
+        .mouse = {.x = params[1] - 1, .y = params[0] - 1},
+    };
   } else {
-    switch (buff[0]) {
-      case 'h':
-        tui_move_left(1);
-        break;
-      case 'j':
-        tui_move_up(1);
-        break;
-      case 'k':
-        tui_move_top(1);
-        break;
-      case 'l':
-        tui_move_right(1);
-        break;
-      case 'q':
-        return true;
-      case '\r': {  // <ENTER>
-        int x, y;
-        tui_get_cursor_pos(tui, &x, &y);
+    event->type = TUI_EVENT_NONE;
+  }
+  return end + 1;
+}
+
+// Merges event into the last one in events if it is redundant. Bursts of
+// wheel scrolls at the same place become one action with a count and only
+// the last of consecutive moves is kept.
+bool _tui_input_coalesce(TUI_EVENT *events, size_t size,
+                         const TUI_EVENT *event) {
+  if (size == 0 || event->type != TUI_EVENT_MOUSE ||
+      events[size - 1].type != TUI_EVENT_MOUSE) {
+    return false;
+  }
+  MOUSE_ACTION *last = &events[size - 1].mouse;
+  const MOUSE_ACTION *action = &event->mouse;
+  if (action->modifiers != last->modifiers) {
+    return false;
+  } else if (action->button == MOUSE_BUTTON_MOVE &&
+      last->button == MOUSE_BUTTON_MOVE) {
+    *last = *action;
+    return true;
+  } else if ((action->button == MOUSE_BUTTON_SCROLL_UP ||
+              action->button == MOUSE_BUTTON_SCROLL_DOWN) &&
+             last->button == action->button && last->x == action->x &&
+             last->y == action->y) {
+    last->count += action->count;
+    return true;
+  }
+  return false;
+}
+
+bool _tui_handle_key(TUI *tui, unsigned char key);
+
+// returns true if the app should quit
+bool _tui_dispatch_event(TUI *tui, const TUI_EVENT *event) {
+  switch (event->type) {
+    case TUI_EVENT_KEY:
+      return _tui_handle_key(tui, event->key);
+    case TUI_EVENT_MOUSE:
+      tui_handle_mouse_action(tui, &event->mouse);
+      break;
+    case TUI_EVENT_CURSOR_POSITION:
+      if (tui->input.is_waiting_cursor_position) {
+        tui->input.is_waiting_cursor_position = false;
         const MOUSE_ACTION mouse_action = {
             .button = MOUSE_BUTTON_LEFT_CLICK,
-            .x = x,
-            .y = y,
+            .x = event->mouse.x,
+            .y = event->mouse.y,
+            .count = 1,
         };
         tui_handle_mouse_action(tui, &mouse_action);
-      } break;
-      case '\b':
-      case 127:  // back space
-        tui_delete_before();
+      }
+      break;
+    case TUI_EVENT_NONE:
+      break;
+  }
+  return false;
+}
+
+// returns true if the app should quit
+bool _tui_handle_key(TUI *tui, unsigned char key) {
+  switch (key) {
+    case 3:  // User pressd Ctr+C
+    case 'q':
+      return true;
+    case 'h':
+      tui_move_left(tui, 1);
+      break;
+    case 'j':
+      tui_move_up(tui, 1);
+      break;
+    case 'k':
+      tui_move_top(tui, 1);
+      break;
+    case 'l':
+      tui_move_right(tui, 1);
+      break;
+    case '\r':  // <ENTER>
+      // clicks where the cursor is once the terminal reports its position
+      tui->input.is_waiting_cursor_position = true;
+      _tui_sink_flush(&tui->sink, "\033[6n", 4);
+      break;
+    case '\b':
+    case 127:  // back space
+      tui_delete_before(tui);
+      break;
+    default:
+      /*printf("unknown:%c,%d\n\r", key, key);*/
+      /*sleep(1);*/
+      break;
+  }
+  return false;
+}
+
+// Reads all pending input and dispatches every complete event in it.
+// Returns true if the app should quit.
+bool _tui_handle_input(TUI *tui) {
+  TUI_INPUT *input = &tui->input;
+  _tui_input_fill(input);
+
+  const int64_t now = nano_time();
+  const bool is_timed_out =
+      input->pending_since != 0 &&
+      now - input->pending_since >= _TUI_ESCAPE_TIMEOUT;
+
+  TUI_EVENT events[64];
+  size_t events_size = 0;
+  while (input->size != 0) {
+    TUI_EVENT event;
+    const size_t size = _tui_input_decode(input, is_timed_out, &event);
+    if (size == 0) {
+      break;
+    }
+    _tui_input_consume(input, size);
+
+    if (event.type == TUI_EVENT_NONE ||
+        _tui_input_coalesce(events, events_size, &event)) {
+      continue;
+    }
+    events[events_size++] = event;
+
+    if (events_size == sizeof(events) / sizeof(*events) ||
+        input->size == 0) {
+      for (size_t i = 0; i < events_size; ++i) {
+        if (_tui_dispatch_event(tui, &events[i])) {
+          return true;
+        }
+      }
+      events_size = 0;
+      _tui_input_fill(input);
+    }
+  }
+  for (size_t i = 0; i < events_size; ++i) {
+    if (_tui_dispatch_event(tui, &events[i])) {
+      return true;
+    }
+  }
+
+  if (input->size == 0) {
+    input->pending_since = 0;
+  } else if (input->pending_since == 0 || is_timed_out) {
+    input->pending_since = now;
+  }
+  return false;
+}
+
+bool handle_input(TUI *tui) {
+  const long int start = nano_time();
+  const bool should_quit = _tui_handle_input(tui);
+  _tui_stage_end(&tui->stats, TUI_STAGE_INPUT, start);
+  return should_quit;
+}
+
+// nanoseconds until an incomplete escape sequence in the input times out,
+// -1 if there is none
+int64_t _tui_input_get_timeout(TUI *tui) {
+  if (tui->input.pending_since == 0) {
+    return -1;
+  }
+  const int64_t remaining =
+      tui->input.pending_since + _TUI_ESCAPE_TIMEOUT - nano_time();
+  return remaining < 0 ? 0 : remaining;
+}
+
+void tui_start_app(TUI *tui, WIDGET_BUILDER widget_builder, void *context,
+                   int fps) {
+  tui_main_loop(tui, widget_builder, context, fps);
+}
+
+// counts the frames laid out, for WIDGET.layout_frame
+uint64_t _tui_layout_frame = 0;
+
+// area a measured widget has drawn to, origin is where its parent starts
+TUI_RECT _tui_layout_rect(const WIDGET_LAYOUT *layout, int origin_x,
+                          int origin_y) {
+  const int x = origin_x + layout->x;
+  const int y = origin_y + layout->y;
+  return (TUI_RECT){
+      .width_begin = x,
+      .width_end = x + layout->width,
+      .height_begin = y,
+      .height_end = y + layout->height,
+  };
+}
+
+TUI_RECT _tui_widget_rect(const WIDGET *widget, int origin_x, int origin_y) {
+  return _tui_layout_rect(&widget->layout, origin_x, origin_y);
+}
+
+// keeps the layout of the last frame before the widget is laid out again
+void _tui_keep_old_layout(WIDGET *widget) {
+  if (widget->layout_frame != _tui_layout_frame) {
+    widget->layout_frame = _tui_layout_frame;
+    widget->old_layout = widget->layout;
+  }
+}
+
+// the layout a widget of the last frame's tree had in that frame
+const WIDGET_LAYOUT *_tui_old_layout(const WIDGET *widget) {
+  return widget->layout_frame == _tui_layout_frame ? &widget->old_layout
+                                                   : &widget->layout;
+}
+
+// lines of a layout that fit in height
+size_t _tui_visible_lines(const TUI_TEXT_LAYOUT *layout, int height) {
+  if (height <= 0) {
+    return 0;
+  }
+  return layout->lines_size < (size_t)height ? layout->lines_size
+                                             : (size_t)height;
+}
+
+// whether line i of the visible lines of text ends with an ellipsis
+bool _tui_has_ellipsis(const TEXT_METADATA *text,
+                       const TUI_TEXT_LAYOUT *layout, size_t i,
+                       size_t visible_lines) {
+  return text->style.has_ellipsis &&
+         (layout->lines[i].is_cut ||
+          (i + 1 == visible_lines && visible_lines < layout->lines_size));
+}
+
+// Copies layout to where the text widget is allocated, so that it goes away
+// along with it. NULL if that is a frame arena which is not the active one.
+TUI_TEXT_LAYOUT *_tui_copy_text_layout(const WIDGET *widget,
+                                       const TUI_TEXT_LAYOUT *layout) {
+  if (widget->is_in_arena && _tui_active_arena == NULL) {
+    return NULL;
+  }
+  const size_t lines_size = layout->lines_size * sizeof(TUI_TEXT_LINE);
+  const size_t size = sizeof(TUI_TEXT_LAYOUT) + lines_size;
+  TUI_TEXT_LAYOUT *copy = widget->is_in_arena
+                              ? _tui_arena_alloc(_tui_active_arena, size)
+                              : malloc(size);
+  copy->width = layout->width;
+  copy->lines = (TUI_TEXT_LINE *)(copy + 1);
+  memcpy(copy->lines, layout->lines, lines_size);
+  copy->lines_size = layout->lines_size;
+  copy->lines_capacity = layout->lines_size;
+  return copy;
+}
+
+// Gives a text widget a layout of its own, in place of one at another width
+void _tui_set_text_layout(WIDGET *widget, TUI_TEXT_LAYOUT *layout) {
+  TEXT_METADATA *text = widget->metadata;
+  if (!widget->is_in_arena) {
+    free(text->layout);
+  }
+  text->layout = layout;
+}
+
+// The lines of a text widget at width, laid out only if it has none there
+const TUI_TEXT_LAYOUT *_tui_text_widget_layout(WIDGET *widget, int width) {
+  TEXT_METADATA *text = widget->metadata;
+  if (text->layout != NULL && text->layout->width == width) {
+    return text->layout;
+  }
+  _tui_layout_text(&_tui_text_scratch, text, width);
+  TUI_TEXT_LAYOUT *copy = _tui_copy_text_layout(widget, &_tui_text_scratch);
+  if (copy == NULL) {
+    return &_tui_text_scratch;
+  }
+  _tui_set_text_layout(widget, copy);
+  return copy;
+}
+
+void _tui_measure_text(const TEXT_METADATA *text,
+                       const TUI_TEXT_LAYOUT *layout, int available_width,
+                       int available_height, int *width, int *height) {
+  const size_t lines = _tui_visible_lines(layout, available_height);
+  *width = 0;
+  for (size_t i = 0; i < lines; ++i) {
+    int line_width = layout->lines[i].width;
+    if (_tui_has_ellipsis(text, layout, i, lines) &&
+        line_width < available_width) {
+      line_width += 1;
+    }
+    if (line_width > *width) {
+      *width = line_width;
+    }
+  }
+  *height = lines;
+}
+
+// draws a line of text from x on row y, the ellipsis takes the last column
+// if the line has to make room for it
+void _tui_draw_text_line(TUI *tui, const TUI_RECT *clip,
+                         const TEXT_METADATA *text, const TUI_TEXT_LINE *line,
+                         int x, int y, int width, bool has_ellipsis) {
+  const char *const bytes = text->text;
+  const int tab_width = _tui_tab_width(&text->style);
+  const int limit = has_ellipsis ? width - 1 : width;
+  const uint16_t color = _tui_color_index(&tui->palette, text->color);
+  int column = 0;
+  // where the last character went, combining marks after it join it there
+  int last_x = -1;
+  size_t i = line->begin;
+  while (i < line->end) {
+    const size_t run = _tui_printable_run(bytes + i, line->end - i);
+    if (run != 0) {
+      const int size =
+          run < (size_t)(limit - column) ? (int)run : limit - column;
+      if (size <= 0) {
+        break;
+      }
+      _tui_draw_ascii(tui, clip, x + column, y, bytes + i, size, color);
+      i += size;
+      column += size;
+      last_x = x + column - 1;
+      if ((size_t)size < run) {
         break;
-      default:
-        /*printf("unknown:%c,%d\n\r", buff[0], buff[0]);*/
-        /*sleep(1);*/
+      }
+      continue;
+    }
+
+    TUI_TEXT_CHAR character;
+    _tui_read_char(bytes + i, line->end - i, column, tab_width, &character);
+    i += character.size;
+    if (character.codepoint == '\t') {  // as spaces up to the tab stop
+      const int columns = character.columns < limit - column
+                              ? character.columns
+                              : limit - column;
+      if (columns <= 0) {
         break;
+      }
+      static const char spaces[] = "        ";
+      for (int j = 0; j < columns; j += sizeof(spaces) - 1) {
+        const int size = columns - j < (int)sizeof(spaces) - 1
+                             ? columns - j
+                             : (int)sizeof(spaces) - 1;
+        _tui_draw_ascii(tui, clip, x + column + j, y, spaces, size, color);
+      }
+      column += columns;
+      last_x = x + column - 1;
+    } else if (character.columns == 0) {
+      if (last_x != -1) {
+        _tui_combine_char(tui, clip, last_x, y, character.codepoint);
+      }
+    } else if (character.columns > width) {
+      continue;  // never fits, the layout skipped it too
+    } else if (column + character.columns > limit) {
+      break;
+    } else {
+      _tui_draw_char(tui, clip, x + column, y, character.codepoint,
+                     character.columns, color);
+      last_x = x + column;
+      column += character.columns;
     }
   }
-  return false;
-}
+  if (has_ellipsis) {
+    _tui_draw_char(tui, clip, x + column, y, 0x2026, 1, color);  // …
+  }
+}
+
+// Draws text laid out in the given space from x, y inside of clip, returns
+// the rows it took. It is laid out again if layout is NULL or at another
+// width.
+int _tui_draw_text(TUI *tui, const TUI_RECT *clip, const TEXT_METADATA *text,
+                   const TUI_TEXT_LAYOUT *layout, int x, int y,
+                   int available_width, int available_height) {
+  TUI_TEXT_LAYOUT scratch = {0};
+  if (layout == NULL || layout->width != available_width) {
+    _tui_layout_text(&scratch, text, available_width);
+    layout = &scratch;
+  }
+  const size_t lines = _tui_visible_lines(layout, available_height);
+  // only the lines inside of clip
+  const size_t begin =
+      clip->height_begin > y ? (size_t)(clip->height_begin - y) : 0;
+  const size_t end = clip->height_end > y ? (size_t)(clip->height_end - y) : 0;
+  for (size_t i = begin; i < lines && i < end; ++i) {
+    _tui_draw_text_line(tui, clip, text, &layout->lines[i], x, y + i,
+                        available_width,
+                        _tui_has_ellipsis(text, layout, i, lines));
+  }
+  _tui_delete_text_layout(&scratch);
+  return lines;
+}
+
+// Measures the widget for the given available space and positions its
+// children relative to it. Layout does not depend on where the widget is
+// placed, so the result is memoized per widget for its constraint normalized
+// to its origin, and a widget that is only moved keeps its measurement.
+void _tui_measure_widget(WIDGET *widget, int available_width,
+                         int available_height, int *width, int *height) {
+  // its parent moves it after this
+  _tui_keep_old_layout(widget);
+  WIDGET_LAYOUT *layout = &widget->layout;
+  if (layout->is_valid && layout->available_width == available_width &&
+      layout->available_height == available_height) {
+    *width = layout->width;
+    *height = layout->height;
+    return;
+  }
+
+  switch (widget->type) {
+    case WIDGET_TYPE_TEXT: {
+      _tui_measure_text(widget->metadata,
+                        _tui_text_widget_layout(widget, available_width),
+                        available_width, available_height, width, height);
+    } break;
+    case WIDGET_TYPE_BUTTON: {
+      const BUTTON_METADATA *metadata = widget->metadata;
+      *width = 0;
+      *height = 0;
+      if (metadata->child != NULL) {
+        _tui_measure_widget(metadata->child, available_width,
+                            available_height, width, height);
+        metadata->child->layout.x = 0;
+        metadata->child->layout.y = 0;
+      }
+    } break;
+    case WIDGET_TYPE_COLUMN: {
+      const COLUMN_METADATA *metadata = widget->metadata;
+      *width = 0;
+      *height = 0;
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        WIDGET *child = metadata->children->widgets[i];
+        int width_temp, height_temp;
+        _tui_measure_widget(child, available_width, available_height - *height,
+                            &width_temp, &height_temp);
+        child->layout.x = 0;
+        child->layout.y = *height;
+        *height += height_temp;
+        if (width_temp > *width) {
+          *width = width_temp;
+        }
+      }
+    } break;
+    case WIDGET_TYPE_ROW: {
+      const ROW_METADATA *metadata = widget->metadata;
+      *width = 0;
+      *height = 0;
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        WIDGET *child = metadata->children->widgets[i];
+        int width_temp, height_temp;
+        _tui_measure_widget(child, available_width - *width, available_height,
+                            &width_temp, &height_temp);
+        child->layout.x = *width;
+        child->layout.y = 0;
+        *width += width_temp;
+        if (height_temp > *height) {
+          *height = height_temp;
+        }
+      }
+    } break;
+    case WIDGET_TYPE_BOX: {
+      const BOX_METADATA *metadata = widget->metadata;
+      int box_width = available_width;
+      int box_height = available_height;
+
+      if (metadata->width != MIN_WIDTH && metadata->width != MAX_WIDTH &&
+          metadata->width < available_width) {
+        box_width = metadata->width;
+      }
+      if (metadata->height != MIN_HEIGHT && metadata->height != MAX_HEIGHT &&
+          metadata->height < available_height) {
+        box_height = metadata->height;
+      }
+
+      if (metadata->child != NULL) {
+        int temp_width, temp_height;
+        _tui_measure_widget(metadata->child, box_width, box_height,
+                            &temp_width, &temp_height);
+        metadata->child->layout.x = 0;
+        metadata->child->layout.y = 0;
+        if (metadata->width == MIN_WIDTH) {
+          box_width = temp_width;
+        }
+        if (metadata->height == MIN_HEIGHT) {
+          box_height = temp_height;
+        }
+      }
+
+      *width = box_width;
+      *height = box_height;
+    } break;
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      // a column cut off at the bottom of the available space. Items are
+      // built until they fill it, items that take no rows are built past.
+      SCROLL_VIEW_METADATA *metadata = widget->metadata;
+      *width = 0;
+      *height = 0;
+      size_t page_size = 0;
+      for (size_t i = 0; i < metadata->children->size ||
+                         (*height < available_height &&
+                          metadata->offset + i < metadata->item_count);
+           ++i) {
+        if (i == metadata->children->size) {
+          _tui_scroll_view_build_item(widget);
+        }
+        WIDGET *child = metadata->children->widgets[i];
+        int width_temp, height_temp;
+        _tui_measure_widget(child, available_width, available_height - *height,
+                            &width_temp, &height_temp);
+        child->layout.x = 0;
+        child->layout.y = *height;
+        *height += height_temp;
+        if (width_temp > *width) {
+          *width = width_temp;
+        }
+        if (*height <= available_height) {
+          ++page_size;
+        }
+      }
+      if (*height > available_height) {
+        *height = available_height;
+      }
+      metadata->state->page_size = page_size;
+    } break;
+    case WIDGET_TYPE_LOG_VIEW: {
+      // the newest lines from the bottom up, the newest is cut if it alone
+      // doesn't fit
+      LOG_VIEW_METADATA *metadata = widget->metadata;
+      *width = 0;
+      *height = 0;
+      size_t line = metadata->end_line;
+      pthread_mutex_lock(&metadata->log->mutex);
+      TEXT_METADATA text;
+      while (*height < available_height &&
+             _tui_log_view_line(metadata, line - 1, &text)) {
+        int width_temp, height_temp;
+        _tui_layout_text(&_tui_text_scratch, &text, available_width);
+        _tui_measure_text(&text, &_tui_text_scratch, available_width,
+                          available_height, &width_temp, &height_temp);
+        if (height_temp == 0 || *height + height_temp > available_height) {
+          break;
+        }
+        --line;
+        *height += height_temp;
+        if (width_temp > *width) {
+          *width = width_temp;
+        }
+      }
+      pthread_mutex_unlock(&metadata->log->mutex);
+      metadata->first_line = line;
+    } break;
+    default:
+      fprintf(stderr, "widget type '%d' went wrong in _tui_measure_widget",
+              widget->type);
+      exit(1);
+  }
+
+  layout->is_valid = true;
+  layout->available_width = available_width;
+  layout->available_height = available_height;
+  layout->width = *width;
+  layout->height = *height;
+}
+
+// draws a measured widget, touching only the cells inside of clip
+void _tui_rasterize_widget(TUI *tui, const WIDGET *widget, int origin_x,
+                           int origin_y, const TUI_RECT *clip) {
+  const TUI_RECT rect = _tui_widget_rect(widget, origin_x, origin_y);
+  if (!_tui_rect_intersects(&rect, clip)) {
+    return;
+  }
+  const int x = rect.width_begin;
+  const int y = rect.height_begin;
+
+  switch (widget->type) {
+    case WIDGET_TYPE_TEXT:
+      _tui_draw_text(tui, clip, widget->metadata,
+                     ((const TEXT_METADATA *)widget->metadata)->layout, x, y,
+                     widget->layout.available_width,
+                     widget->layout.available_height);
+      break;
+    case WIDGET_TYPE_BUTTON: {
+      const BUTTON_METADATA *metadata = widget->metadata;
+      if (metadata->child != NULL) {
+        _tui_rasterize_widget(tui, metadata->child, x, y, clip);
+      }
+    } break;
+    case WIDGET_TYPE_COLUMN: {
+      const COLUMN_METADATA *metadata = widget->metadata;
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        _tui_rasterize_widget(tui, metadata->children->widgets[i], x, y, clip);
+      }
+    } break;
+    case WIDGET_TYPE_ROW: {
+      const ROW_METADATA *metadata = widget->metadata;
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        _tui_rasterize_widget(tui, metadata->children->widgets[i], x, y, clip);
+      }
+    } break;
+    case WIDGET_TYPE_BOX: {
+      const BOX_METADATA *metadata = widget->metadata;
+      if (metadata->child != NULL) {
+        _tui_rasterize_widget(tui, metadata->child, x, y, clip);
+      }
+
+      if (metadata->color == COLOR_NO_COLOR) {
+        break;
+      }
+      const uint16_t color = _tui_color_index(&tui->palette, metadata->color);
+      TUI_RECT fill = rect;
+      _tui_rect_clip(&fill, clip);
+      for (int j = fill.height_begin; j < fill.height_end; ++j) {
+        for (int i = fill.width_begin; i < fill.width_end; ++i) {
+          _tui_set_cell_background_color_if_not_set(tui, i, j, color);
+        }
+      }
+    } break;
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      const SCROLL_VIEW_METADATA *metadata = widget->metadata;
+      TUI_RECT view = rect;
+      _tui_rect_clip(&view, clip);
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        _tui_rasterize_widget(tui, metadata->children->widgets[i], x, y,
+                              &view);
+      }
+    } break;
+    case WIDGET_TYPE_LOG_VIEW: {
+      const LOG_VIEW_METADATA *metadata = widget->metadata;
+      TUI_RECT view = rect;
+      _tui_rect_clip(&view, clip);
+      int line_y = y;
+      pthread_mutex_lock(&metadata->log->mutex);
+      for (size_t i = metadata->first_line; i < metadata->end_line; ++i) {
+        // lines dropped by appends since the layout are left blank
+        TEXT_METADATA text;
+        if (_tui_log_view_line(metadata, i, &text)) {
+          line_y += _tui_draw_text(tui, &view, &text, NULL, x, line_y,
+                                   widget->layout.available_width,
+                                   rect.height_end - line_y);
+        }
+      }
+      pthread_mutex_unlock(&metadata->log->mutex);
+    } break;
+    default:
+      fprintf(stderr, "widget type '%d' went wrong in _tui_rasterize_widget",
+              widget->type);
+      exit(1);
+  }
+}
+
+// Registers the area of every button in widget, after the buttons inside it
+// so that the outermost one wins like it always did. Scroll views go to
+// scroll_index before the ones inside them so that the innermost one wins.
+void _tui_collect_hit_targets(TUI_HIT_INDEX *index,
+                              TUI_HIT_INDEX *scroll_index, const WIDGET *widget,
+                              int origin_x, int origin_y,
+                              const TUI_RECT *clip) {
+  if (widget == NULL) {
+    return;
+  }
+  const TUI_RECT rect = _tui_widget_rect(widget, origin_x, origin_y);
+  const int x = rect.width_begin;
+  const int y = rect.height_begin;
+
+  switch (widget->type) {
+    case WIDGET_TYPE_TEXT:
+    case WIDGET_TYPE_LOG_VIEW:
+      break;
+    case WIDGET_TYPE_BUTTON: {
+      const BUTTON_METADATA *metadata = widget->metadata;
+      if (metadata->child != NULL) {
+        _tui_collect_hit_targets(index, scroll_index, metadata->child, x, y,
+                                 clip);
+        TUI_RECT area = rect;
+        _tui_rect_clip(&area, clip);
+        _tui_hit_index_add(index, &area, metadata->callback,
+                           metadata->context);
+      }
+    } break;
+    case WIDGET_TYPE_COLUMN: {
+      const COLUMN_METADATA *metadata = widget->metadata;
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        _tui_collect_hit_targets(index, scroll_index,
+                                 metadata->children->widgets[i], x, y, clip);
+      }
+    } break;
+    case WIDGET_TYPE_ROW: {
+      const ROW_METADATA *metadata = widget->metadata;
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        _tui_collect_hit_targets(index, scroll_index,
+                                 metadata->children->widgets[i], x, y, clip);
+      }
+    } break;
+    case WIDGET_TYPE_BOX: {
+      const BOX_METADATA *metadata = widget->metadata;
+      _tui_collect_hit_targets(index, scroll_index, metadata->child, x, y,
+                                 clip);
+    } break;
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      const SCROLL_VIEW_METADATA *metadata = widget->metadata;
+      TUI_RECT area = rect;
+      _tui_rect_clip(&area, clip);
+      _tui_hit_index_add(scroll_index, &area, _tui_scroll_view_on_mouse,
+                         metadata->state);
+      for (size_t i = 0; i < metadata->children->size; ++i) {
+        _tui_collect_hit_targets(index, scroll_index,
+                                 metadata->children->widgets[i], x, y, &area);
+      }
+    } break;
+    default:
+      fprintf(stderr,
+              "widget type '%d' went wrong in _tui_collect_hit_targets",
+              widget->type);
+      exit(1);
+  }
+}
+
+void _tui_draw_widget_to_cells(TUI *tui, WIDGET *widget, int width_begin,
+                               int width_end, int height_begin, int height_end,
+                               int *child_width, int *child_height) {
+  int width, height;
+  _tui_measure_widget(widget, width_end - width_begin,
+                      height_end - height_begin, &width, &height);
+  widget->layout.x = width_begin;
+  widget->layout.y = height_begin;
+  *child_width = width_begin + width;
+  *child_height = height_begin + height;
+
+  TUI_RECT clip = _tui_widget_rect(widget, 0, 0);
+  const TUI_RECT screen = {0, tui_get_width(tui), 0, tui_get_height(tui)};
+  _tui_rect_clip(&clip, &screen);
+  _tui_rasterize_widget(tui, widget, 0, 0, &clip);
+  _tui_collect_hit_targets(&tui->hit_index, &tui->scroll_index, widget, 0, 0,
+                           &screen);
+}
+
+// gives unchanged subtrees of new_widget the layout of their twin in
+// old_widget, so they don't have to be laid out again
+void _tui_reconcile_widget(const WIDGET *old_widget, WIDGET *new_widget,
+                           bool is_known_equal) {
+  if (old_widget == NULL || new_widget == NULL ||
+      old_widget->type != new_widget->type) {
+    return;
+  }
+  const bool is_equal =
+      is_known_equal || tui_widget_eqauls(old_widget, new_widget);
+  if (is_equal) {
+    new_widget->equal_frame = _tui_layout_frame;
+  }
+  if (is_equal && new_widget != old_widget) {
+    const WIDGET_LAYOUT old_layout = *_tui_old_layout(old_widget);
+    _tui_keep_old_layout(new_widget);
+    new_widget->layout = old_layout;
+  }
+
+  switch (new_widget->type) {
+    case WIDGET_TYPE_TEXT: {
+      // measure is skipped for the copied layout, so the lines come along.
+      // a single line is laid out again by draw for about what drawing it costs
+      const TUI_TEXT_LAYOUT *old_layout =
+          ((const TEXT_METADATA *)old_widget->metadata)->layout;
+      const TUI_TEXT_LAYOUT *new_layout =
+          ((const TEXT_METADATA *)new_widget->metadata)->layout;
+      if (is_equal && old_layout != NULL && old_layout->lines_size > 1 &&
+          (new_layout == NULL || new_layout->width != old_layout->width)) {
+        TUI_TEXT_LAYOUT *copy = _tui_copy_text_layout(new_widget, old_layout);
+        if (copy != NULL) {
+          _tui_set_text_layout(new_widget, copy);
+        }
+      }
+    } break;
+    case WIDGET_TYPE_LOG_VIEW:
+      if (is_equal) {
+        // found by the layout that is skipped now
+        ((LOG_VIEW_METADATA *)new_widget->metadata)->first_line =
+            ((const LOG_VIEW_METADATA *)old_widget->metadata)->first_line;
+      }
+      break;
+    case WIDGET_TYPE_BUTTON: {
+      const BUTTON_METADATA *old_data = old_widget->metadata;
+      const BUTTON_METADATA *new_data = new_widget->metadata;
+      _tui_reconcile_widget(old_data->child, new_data->child, is_equal);
+    } break;
+    case WIDGET_TYPE_COLUMN:
+    case WIDGET_TYPE_ROW:
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      // column, row and scroll view metadata start with their children
+      const WIDGET_ARRAY *old_children =
+          ((const COLUMN_METADATA *)old_widget->metadata)->children;
+      const WIDGET_ARRAY *new_children =
+          ((const COLUMN_METADATA *)new_widget->metadata)->children;
+      for (size_t i = 0;
+           i < old_children->size && i < new_children->size; ++i) {
+        _tui_reconcile_widget(old_children->widgets[i],
+                              new_children->widgets[i], is_equal);
+      }
+    } break;
+    case WIDGET_TYPE_BOX: {
+      const BOX_METADATA *old_data = old_widget->metadata;
+      const BOX_METADATA *new_data = new_widget->metadata;
+      _tui_reconcile_widget(old_data->child, new_data->child, is_equal);
+    } break;
+    default:
+      fprintf(stderr, "widget type '%d' went wrong in _tui_reconcile_widget",
+              new_widget->type);
+      exit(1);
+  }
+}
+
+// compares the widget itself without its children
+bool _tui_widget_shallow_equals(const WIDGET *restrict left,
+                                const WIDGET *restrict right) {
+  if (left->type != right->type) {
+    return false;
+  }
+  switch (left->type) {
+    case WIDGET_TYPE_TEXT: {
+      const TEXT_METADATA *left_data = left->metadata;
+      const TEXT_METADATA *right_data = right->metadata;
+      return left_data->size == right_data->size &&
+             left_data->color == right_data->color &&
+             left_data->style.wrap == right_data->style.wrap &&
+             left_data->style.tab_width == right_data->style.tab_width &&
+             left_data->style.has_ellipsis == right_data->style.has_ellipsis &&
+             memcmp(left_data->text, right_data->text, left_data->size) == 0;
+    }
+    case WIDGET_TYPE_LOG_VIEW: {
+      const LOG_VIEW_METADATA *left_data = left->metadata;
+      const LOG_VIEW_METADATA *right_data = right->metadata;
+      return left_data->log == right_data->log &&
+             left_data->end_line == right_data->end_line &&
+             left_data->last_size == right_data->last_size &&
+             left_data->color == right_data->color;
+    }
+    case WIDGET_TYPE_BUTTON:
+    {
+      const BUTTON_METADATA *left_metadata = left->metadata;
+      const BUTTON_METADATA *right_metadata = right->metadata;
+      return left_metadata->callback == right_metadata->callback &&
+             left_metadata->context == right_metadata->context;
+    }
+    case WIDGET_TYPE_COLUMN:
+    case WIDGET_TYPE_ROW:
+      return true;
+    case WIDGET_TYPE_BOX: {
+      const BOX_METADATA *left_data = left->metadata;
+      const BOX_METADATA *right_data = right->metadata;
+      return left_data->width == right_data->width &&
+             left_data->height == right_data->height &&
+             left_data->color == right_data->color;
+    }
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      const SCROLL_VIEW_METADATA *left_data = left->metadata;
+      const SCROLL_VIEW_METADATA *right_data = right->metadata;
+      return left_data->state == right_data->state &&
+             left_data->offset == right_data->offset &&
+             left_data->item_count == right_data->item_count &&
+             left_data->item_builder == right_data->item_builder &&
+             left_data->context == right_data->context;
+    }
+    default:
+      fprintf(stderr, "widget type '%d' went wrong in "
+              "_tui_widget_shallow_equals", left->type);
+      exit(1);
+  }
+}
+
+// collects the area where the measured old_widget and new_widget draw
+// differently into damage, origins are where their parents start
+void _tui_collect_damage(const WIDGET *old_widget, int old_origin_x,
+                         int old_origin_y, const WIDGET *new_widget,
+                         int new_origin_x, int new_origin_y,
+                         TUI_RECT *damage) {
+  if (old_widget == NULL || new_widget == NULL) {
+    if (old_widget != NULL) {
+      const TUI_RECT rect = _tui_layout_rect(_tui_old_layout(old_widget),
+                                             old_origin_x, old_origin_y);
+      _tui_rect_add(damage, &rect);
+    }
+    if (new_widget != NULL) {
+      const TUI_RECT rect =
+          _tui_widget_rect(new_widget, new_origin_x, new_origin_y);
+      _tui_rect_add(damage, &rect);
+    }
+    return;
+  }
+
+  const WIDGET_LAYOUT *old_layout = _tui_old_layout(old_widget);
+  const TUI_RECT old_rect =
+      _tui_layout_rect(old_layout, old_origin_x, old_origin_y);
+  const TUI_RECT new_rect =
+      _tui_widget_rect(new_widget, new_origin_x, new_origin_y);
+  const bool is_same_layout =
+      _tui_rect_equals(&old_rect, &new_rect) &&
+      old_layout->available_width == new_widget->layout.available_width &&
+      old_layout->available_height == new_widget->layout.available_height;
+
+  if (!is_same_layout || !_tui_widget_shallow_equals(old_widget, new_widget)) {
+    _tui_rect_add(damage, &old_rect);
+    _tui_rect_add(damage, &new_rect);
+    return;
+  } else if (new_widget->equal_frame == _tui_layout_frame) {
+    return;  // compared by _tui_reconcile_widget already
+  }
+
+  const int x = new_rect.width_begin;
+  const int y = new_rect.height_begin;
+
+  switch (new_widget->type) {
+    case WIDGET_TYPE_TEXT:
+    case WIDGET_TYPE_LOG_VIEW:
+      break;
+    case WIDGET_TYPE_BUTTON:
+      _tui_collect_damage(
+          ((const BUTTON_METADATA *)old_widget->metadata)->child, x, y,
+          ((const BUTTON_METADATA *)new_widget->metadata)->child, x, y, damage);
+      break;
+    case WIDGET_TYPE_COLUMN:
+    case WIDGET_TYPE_ROW:
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      const WIDGET_ARRAY *old_children =
+          ((const COLUMN_METADATA *)old_widget->metadata)->children;
+      const WIDGET_ARRAY *new_children =
+          ((const COLUMN_METADATA *)new_widget->metadata)->children;
+      const size_t size = old_children->size > new_children->size
+                              ? old_children->size
+                              : new_children->size;
+      for (size_t i = 0; i < size; ++i) {
+        _tui_collect_damage(
+            i < old_children->size ? old_children->widgets[i] : NULL, x, y,
+            i < new_children->size ? new_children->widgets[i] : NULL, x, y,
+            damage);
+      }
+    } break;
+    case WIDGET_TYPE_BOX:
+      _tui_collect_damage(
+          ((const BOX_METADATA *)old_widget->metadata)->child, x, y,
+          ((const BOX_METADATA *)new_widget->metadata)->child, x, y, damage);
+      break;
+    default:
+      fprintf(stderr, "widget type '%d' went wrong in _tui_collect_damage",
+              new_widget->type);
+      exit(1);
+  }
+}
+
+int _tui_get_background_color_ascii(TUI *tui, COLOR color) {
+  return tui_change_terminal_background_color(tui, color);
+}
+
+bool _tui_cell_equals(const TERMINAL_CELL *restrict left,
+                      const TERMINAL_CELL *restrict right) {
+  return memcmp(left, right, sizeof(TERMINAL_CELL)) == 0;
+}
+
+// worst case bytes of a cursor movement: "\033[" + 5 digits + ';' + 5 digits
+// + 'H'
+const size_t _TUI_MAX_MOVE_SIZE = 2 + 5 + 1 + 5 + 1;
+// worst case bytes of a color change: "\033[0;" foreground ';' background 'm'
+// with both like "38;2;255;255;255"
+const size_t _TUI_MAX_COLOR_SIZE = 4 + 16 + 1 + 16 + 1;
+
+char *_tui_encode_uint(char *out, unsigned int value) {
+  char digits[10];
+  int i = 0;
+  do {
+    digits[i++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  while (i != 0) {
+    *out++ = digits[--i];
+  }
+  return out;
+}
+
+char *_tui_encode_move_to(char *out, int x, int y) {
+  *out++ = '\033';
+  *out++ = '[';
+  out = _tui_encode_uint(out, y + 1);
+  *out++ = ';';
+  out = _tui_encode_uint(out, x + 1);
+  *out++ = 'H';
+  return out;
+}
+
+int _tui_uint_size(unsigned int value) {
+  int size = 1;
+  for (; value >= 10; value /= 10) {
+    ++size;
+  }
+  return size;
+}
+
+// "\033[" value final
+char *_tui_encode_csi(char *out, unsigned int value, char final) {
+  *out++ = '\033';
+  *out++ = '[';
+  out = _tui_encode_uint(out, value);
+  *out++ = final;
+  return out;
+}
+
+// Moves the cursor to x on row y, relative to cursor_x if the cursor is on that
+// row already and -1 otherwise
+char *_tui_encode_move(char *out, int x, int y, int cursor_x) {
+  if (cursor_x != -1 && cursor_x < x) {
+    return _tui_encode_csi(out, x - cursor_x, 'C');
+  }
+  return _tui_encode_move_to(out, x, y);
+}
+
+// SGR parameters of the 256 colors for the foreground and the background,
+// the first 16 in their shorter ANSI form
+TUI_SGR_PARAMETER _tui_sgr_indexed_colors[2][256];
+// decimal digits of the components of RGB colors
+TUI_SGR_PARAMETER _tui_sgr_decimals[256];
+// the nearest of the first 16 colors for each of the 256
+uint8_t _tui_nearest_16_colors[256];
+
+// The nearest of the 256 colors of recently drawn RGB colors, to not search
+// the palette for every cell of a gradient. An entry is the RGB color shifted
+// over its index, which is at least 16, so 0 is empty. The entries are single
+// words, so threads encoding bands share it without locks.
+atomic_uint _tui_rgb_cache[4096];
+
+// the xterm default of the 256 colors as 0xRRGGBB
+uint32_t _tui_indexed_rgb(int index) {
+  static const uint32_t ansi_colors[16] = {
+      0x000000, 0xCD0000, 0x00CD00, 0xCDCD00, 0x0000EE, 0xCD00CD,
+      0x00CDCD, 0xE5E5E5, 0x7F7F7F, 0xFF0000, 0x00FF00, 0xFFFF00,
+      0x5C5CFF, 0xFF00FF, 0x00FFFF, 0xFFFFFF};
+  static const uint8_t cube_levels[6] = {0, 95, 135, 175, 215, 255};
+  if (index < 16) {
+    return ansi_colors[index];
+  } else if (index < 232) {
+    index -= 16;
+    return cube_levels[index / 36] << 16 | cube_levels[index / 6 % 6] << 8 |
+           cube_levels[index % 6];
+  }
+  const uint32_t gray = 8 + 10 * (index - 232);
+  return gray << 16 | gray << 8 | gray;
+}
+
+int _tui_rgb_distance(uint32_t left, uint32_t right) {
+  const int red = (int)(left >> 16) - (int)(right >> 16);
+  const int green = (int)(left >> 8 & 0xFF) - (int)(right >> 8 & 0xFF);
+  const int blue = (int)(left & 0xFF) - (int)(right & 0xFF);
+  return red * red + green * green + blue * blue;
+}
+
+TUI_SGR_PARAMETER _tui_make_sgr_parameter(const char *format, int value) {
+  TUI_SGR_PARAMETER parameter;
+  char text[16];
+  parameter.size = snprintf(text, sizeof(text), format, value);
+  memcpy(parameter.text, text, sizeof(parameter.text));
+  return parameter;
+}
+
+void _tui_build_color_tables() {
+  for (int i = 0; i < 256; ++i) {
+    if (i < 8) {
+      _tui_sgr_indexed_colors[0][i] = _tui_make_sgr_parameter("3%d", i);
+      _tui_sgr_indexed_colors[1][i] = _tui_make_sgr_parameter("4%d", i);
+    } else if (i < 16) {
+      _tui_sgr_indexed_colors[0][i] = _tui_make_sgr_parameter("9%d", i - 8);
+      _tui_sgr_indexed_colors[1][i] = _tui_make_sgr_parameter("10%d", i - 8);
+    } else {
+      _tui_sgr_indexed_colors[0][i] = _tui_make_sgr_parameter("38;5;%d", i);
+      _tui_sgr_indexed_colors[1][i] = _tui_make_sgr_parameter("48;5;%d", i);
+    }
+    _tui_sgr_decimals[i] = _tui_make_sgr_parameter("%d", i);
+
+    int nearest = i < 16 ? i : 0;
+    if (i >= 16) {
+      for (int j = 1; j < 16; ++j) {
+        if (_tui_rgb_distance(_tui_indexed_rgb(i), _tui_indexed_rgb(j)) <
+            _tui_rgb_distance(_tui_indexed_rgb(i),
+                              _tui_indexed_rgb(nearest))) {
+          nearest = j;
+        }
+      }
+    }
+    _tui_nearest_16_colors[i] = nearest;
+  }
+}
+
+// the nearest of the color cube and the gray ramp, the first 16 colors differ
+// between terminals
+int _tui_nearest_indexed_color(uint32_t rgb) {
+  const uint32_t slot = (rgb * 0x9E3779B1u) >> 20;
+  const unsigned int entry =
+      atomic_load_explicit(&_tui_rgb_cache[slot], memory_order_relaxed);
+  if (entry >> 8 == rgb && entry != 0) {
+    return entry & 0xFF;
+  }
+
+  int cube = 0;
+  for (int shift = 16; shift >= 0; shift -= 8) {
+    const int value = rgb >> shift & 0xFF;
+    cube = cube * 6 + (value < 48 ? 0 : value < 115 ? 1 : (value - 35) / 40);
+  }
+  cube += 16;
+  const int average = ((rgb >> 16) + (rgb >> 8 & 0xFF) + (rgb & 0xFF)) / 3;
+  int gray = average < 8 ? 0 : (average - 3) / 10;
+  gray = 232 + (gray < 23 ? gray : 23);
+  const int index = _tui_rgb_distance(rgb, _tui_indexed_rgb(gray)) <
+                            _tui_rgb_distance(rgb, _tui_indexed_rgb(cube))
+                        ? gray
+                        : cube;
+
+  atomic_store_explicit(&_tui_rgb_cache[slot], rgb << 8 | index,
+                        memory_order_relaxed);
+  return index;
+}
+
+// The palette index of an RGB color, which takes a free slot the first time
+// it is drawn. Threads race for a slot by compare and swap, and the loser
+// goes on to the next slot unless the winner added the same color.
+uint16_t _tui_rgb_color_index(TUI_PALETTE *palette, uint32_t rgb) {
+  const unsigned int entry = rgb | 1u << 24;
+  size_t slot = (rgb * 0x9E3779B1u) >> (32 - TUI_PALETTE_BITS);
+  for (int i = 0; i < TUI_PALETTE_PROBES; ++i) {
+    unsigned int found = atomic_load_explicit(&palette->rgb_colors[slot],
+                                              memory_order_relaxed);
+    if (found == 0 && atomic_compare_exchange_strong_explicit(
+                          &palette->rgb_colors[slot], &found, entry,
+                          memory_order_relaxed, memory_order_relaxed)) {
+      return TUI_COLOR_INDEX_RGB + slot;
+    } else if (found == entry) {
+      return TUI_COLOR_INDEX_RGB + slot;
+    }
+    slot = (slot + 1) & (TUI_PALETTE_SIZE - 1);
+  }
+  // the palette is full around the slot of rgb
+  return TUI_COLOR_INDEX_INDEXED + _tui_nearest_indexed_color(rgb);
+}
+
+uint16_t _tui_color_index(TUI_PALETTE *palette, COLOR color) {
+  if (color == COLOR_NO_COLOR) {
+    return TUI_COLOR_INDEX_NONE;
+  } else if (color & COLOR_RGB) {
+    return _tui_rgb_color_index(palette, color & 0xFFFFFF);
+  } else if (color & COLOR_INDEXED) {
+    return TUI_COLOR_INDEX_INDEXED + (color & 0xFF);
+  }
+  return color;
+}
+
+COLOR _tui_palette_color(const TUI_PALETTE *palette, uint16_t index) {
+  if (index < TUI_COLOR_INDEX_INDEXED) {
+    return index;
+  } else if (index < TUI_COLOR_INDEX_RGB) {
+    return COLOR_INDEXED | (index - TUI_COLOR_INDEX_INDEXED);
+  } else if (index == TUI_COLOR_INDEX_NONE) {
+    return COLOR_NO_COLOR;
+  }
+  const unsigned int entry = atomic_load_explicit(
+      &palette->rgb_colors[index - TUI_COLOR_INDEX_RGB], memory_order_relaxed);
+  return COLOR_RGB | (entry & 0xFFFFFF);
+}
+
+// The color the terminal is asked to draw for color, COLOR_RESET or what
+// it has nearest to it as COLOR_INDEXED or COLOR_RGB
+int32_t _tui_terminal_color(int32_t color, unsigned int terminal_features) {
+  if (color <= COLOR_RESET) {
+    return COLOR_RESET;
+  }
+  int index;
+  if (color & COLOR_RGB) {
+    if (terminal_features & TUI_FEATURE_TRUECOLOR) {
+      return color;
+    }
+    index = _tui_nearest_indexed_color(color & 0xFFFFFF);
+  } else {
+    index = color & 0xFF;
+  }
+  if (!(terminal_features & TUI_FEATURE_256_COLORS)) {
+    index = _tui_nearest_16_colors[index];
+  }
+  return COLOR_INDEXED | index;
+}
+
+// The SGR parameter of a color of _tui_terminal_color
+char *_tui_encode_sgr_color(char *out, int32_t color, bool is_background) {
+  if (color == COLOR_RESET) {
+    *out++ = is_background ? '4' : '3';
+    *out++ = '9';
+  } else if (color & COLOR_INDEXED) {
+    const TUI_SGR_PARAMETER *parameter =
+        &_tui_sgr_indexed_colors[is_background][color & 0xFF];
+    memcpy(out, parameter->text, parameter->size);
+    out += parameter->size;
+  } else {
+    memcpy(out, is_background ? "48;2" : "38;2", 4);
+    out += 4;
+    for (int shift = 16; shift >= 0; shift -= 8) {
+      const TUI_SGR_PARAMETER *parameter =
+          &_tui_sgr_decimals[color >> shift & 0xFF];
+      *out++ = ';';
+      memcpy(out, parameter->text, parameter->size);
+      out += parameter->size;
+    }
+  }
+  return out;
+}
+
+// Sets the terminal to the colors of cell with one SGR that only has the
+// colors that differ from state
+char *_tui_encode_sgr(char *out, const TERMINAL_CELL *cell,
+                      const TUI_PALETTE *palette,
+                      unsigned int terminal_features, TUI_SGR_STATE *state) {
+  const int32_t color = _tui_terminal_color(
+      _tui_palette_color(palette, cell->color), terminal_features);
+  const int32_t background_color = _tui_terminal_color(
+      _tui_palette_color(palette, cell->background_color), terminal_features);
+  bool is_color_changed = state->color != color;
+  bool is_background_color_changed =
+      state->background_color != background_color;
+  if (!is_color_changed && !is_background_color_changed) {
+    return out;
+  }
+
+  // a reset takes the place of the colors that go back to the default ones,
+  // so it is shorter whenever fewer colors are set after it than would change
+  // without it
+  const bool is_reset =
+      state->color == COLOR_NO_COLOR ||
+      state->background_color == COLOR_NO_COLOR ||
+      (color != COLOR_RESET) + (background_color != COLOR_RESET) <
+          is_color_changed + is_background_color_changed;
+  *out++ = '\033';
+  *out++ = '[';
+  if (is_reset) {
+    *out++ = '0';
+    is_color_changed = color != COLOR_RESET;
+    is_background_color_changed = background_color != COLOR_RESET;
+  }
+  if (is_color_changed) {
+    if (is_reset) {
+      *out++ = ';';
+    }
+    out = _tui_encode_sgr_color(out, color, false);
+  }
+  if (is_background_color_changed) {
+    if (is_reset || is_color_changed) {
+      *out++ = ';';
+    }
+    out = _tui_encode_sgr_color(out, background_color, true);
+  }
+  *out++ = 'm';
+
+  state->color = color;
+  state->background_color = background_color;
+  return out;
+}
+
+// The UTF-8 of the cell, nothing for the second cell of a wide character.
+// All of a cluster is copied and out only moved past its size, the space
+// reserved per cell covers it.
+char *_tui_encode_text(char *out, const TERMINAL_CELL *cell,
+                       const TUI_CLUSTERS *clusters) {
+  if (cell->text < 0x80) {
+    *out = (char)cell->text;
+    return out + (cell->text != 0);
+  } else if (cell->text & TUI_CELL_CLUSTER) {
+    const TUI_CLUSTER *cluster =
+        &clusters->clusters[cell->text & ~TUI_CELL_CLUSTER];
+    memcpy(out, cluster->text, sizeof(cluster->text));
+    return out + _tui_cluster_size(cluster);
+  }
+  return _tui_encode_utf8(out, cell->text);
+}
+
+// runs of the same cell shorter than this are always written out
+const int _TUI_MIN_REPEAT = 4;
+
+// Encodes count copies of the cell at x on row y with whichever of writing
+// them out, REP, ECH or EL takes the fewest bytes. The cursor is moved there
+// from cursor_x first, which is then set to where the cursor is left.
+char *_tui_encode_repeat(char *out, const TERMINAL_CELL *cell, int count,
+                         int x, int y, int width, bool is_span_end,
+                         const TUI_CLUSTERS *clusters,
+                         unsigned int terminal_features, int *cursor_x) {
+  const int count_size = _tui_uint_size(count);
+  // UTF-8 of a cell is up to 8 bytes, all of them repeated when written out
+  int text_size = cell->text != 0;
+  if (cell->text & TUI_CELL_CLUSTER) {
+    text_size = (int)_tui_cluster_size(
+        &clusters->clusters[cell->text & ~TUI_CELL_CLUSTER]);
+  } else if (cell->text >= 0x80) {
+    text_size = (int)_tui_utf8_size(cell->text);
+  }
+  const int written_size = count * text_size;
+  // REP repeats the last character only, not the marks combined with it
+  const bool is_repeatable = terminal_features & TUI_FEATURE_REP &&
+                             cell->text != 0 &&
+                             !(cell->text & TUI_CELL_CLUSTER);
+  const int rep_size =
+      is_repeatable ? text_size + 3 + _tui_uint_size(count - 1) : INT_MAX;
+  // erased cells get the background color only on some terminals
+  const bool is_erasable = cell->text == ' ' &&
+                           (terminal_features & TUI_FEATURE_BCE ||
+                            cell->background_color == TUI_COLOR_INDEX_NONE ||
+                            cell->background_color == COLOR_RESET);
+  const bool is_row_end = x + count == width;
+  int erase_size = INT_MAX;
+  if (is_erasable) {
+    // erasing leaves the cursor in place, it is moved past the run after
+    erase_size = is_row_end ? 3 : 3 + count_size;
+    if (!is_span_end) {
+      erase_size += 3 + count_size;
+    }
+  }
+
+  if (*cursor_x != x) {
+    out = _tui_encode_move(out, x, y, *cursor_x);
+  }
+  if (erase_size < written_size && erase_size <= rep_size) {
+    if (is_row_end) {
+      *out++ = '\033';
+      *out++ = '[';
+      *out++ = 'K';
+    } else {
+      out = _tui_encode_csi(out, count, 'X');
+    }
+    *cursor_x = x;
+    return out;
+  } else if (rep_size < written_size) {
+    out = _tui_encode_text(out, cell, clusters);
+    out = _tui_encode_csi(out, count - 1, 'b');
+  } else if (cell->text < 0x80) {
+    memset(out, (char)cell->text, count);
+    out += count;
+  } else {
+    for (int i = 0; i < count; ++i) {
+      out = _tui_encode_text(out, cell, clusters);
+    }
+  }
+  *cursor_x = x + count;
+  return out;
+}
+
+// scrolls encoded per call of _tui_encode_rows at most
+const int _TUI_MAX_SCROLLS = 16;
+// worst case bytes of a scroll: reset, scroll region, scroll and region reset
+const size_t _TUI_MAX_SCROLL_SIZE = 4 + (2 + 5 + 1 + 5 + 1) + (2 + 5 + 1) + 3;
+
+size_t _tui_max_encoded_size(size_t cells) {
+  return cells * (_TUI_MAX_MOVE_SIZE + _TUI_MAX_COLOR_SIZE +
+                  sizeof(((TUI_CLUSTER *)NULL)->text)) +
+         _TUI_MAX_SCROLLS * _TUI_MAX_SCROLL_SIZE;
+}
+
+void _tui_reserve_row_hashes(TUI_ROW_HASHES *hashes, int height) {
+  if (hashes->capacity >= height) {
+    return;
+  }
+  _tui_delete_row_hashes(hashes);
+  hashes->rows = malloc(height * sizeof(*hashes->rows));
+  hashes->front_rows = malloc(height * sizeof(*hashes->front_rows));
+  hashes->table = malloc(2 * height * sizeof(*hashes->table));
+  hashes->capacity = height;
+}
+
+void _tui_delete_row_hashes(TUI_ROW_HASHES *hashes) {
+  free(hashes->rows);
+  free(hashes->front_rows);
+  free(hashes->table);
+  *hashes = (TUI_ROW_HASHES){0};
+}
+
+bool _tui_row_equals(const TERMINAL_CELL *cells,
+                     const TERMINAL_CELL *front_cells, int width, int y) {
+  const size_t begin = (size_t)y * width;
+  return _tui_cell_kernels.first_difference(cells + begin, front_cells + begin,
+                                            width) == (size_t)width;
+}
+
+uint64_t _tui_hash_row(const TERMINAL_CELL *row, int width) {
+  // independent lanes so the multiplications don't wait on each other
+  uint64_t lanes[4] = {1, 2, 3, 4};
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    uint64_t words[4];
+    memcpy(words, row + x, sizeof(words));
+    for (int i = 0; i < 4; ++i) {
+      lanes[i] = (lanes[i] ^ words[i]) * 0xBF58476D1CE4E5B9ULL;
+    }
+  }
+  uint64_t hash = _tui_hash_combine(lanes[0] ^ lanes[1], lanes[2] ^ lanes[3]);
+  for (; x < width; ++x) {
+    uint64_t word;
+    memcpy(&word, row + x, sizeof(word));
+    hash = _tui_hash_combine(hash, word);
+  }
+  return hash;
+}
+
+// Fills table with the rows [height_begin, height_end) of the front by their
+// hash. A slot holds row + 1, negated if more rows have the same hash.
+void _tui_build_row_table(int *table, const uint64_t *front_rows,
+                          int height_begin, int height_end) {
+  const int table_size = 2 * (height_end - height_begin);
+  memset(table, 0, table_size * sizeof(*table));
+  for (int y = height_begin; y < height_end; ++y) {
+    for (size_t i = front_rows[y] % table_size;; i = (i + 1) % table_size) {
+      if (table[i] == 0) {
+        table[i] = y + 1;
+        break;
+      } else if (front_rows[abs(table[i]) - 1] == front_rows[y]) {
+        table[i] = -abs(table[i]);
+        break;
+      }
+    }
+  }
+}
+
+// the only front row with hash, -1 if there is none or more than one
+int _tui_find_row(const int *table, const uint64_t *front_rows,
+                  int table_size, uint64_t hash) {
+  for (size_t i = hash % table_size; table[i] != 0;
+       i = (i + 1) % table_size) {
+    if (front_rows[abs(table[i]) - 1] == hash) {
+      return table[i] > 0 ? table[i] - 1 : -1;
+    }
+  }
+  return -1;
+}
+
+// Finds blocks of rows in [height_begin, height_end) that only moved up or
+// down since the front cells were drawn and moves them on the terminal with a
+// scroll region (DECSTBM) and SU or SD, so just the rows uncovered by the
+// scroll are encoded afterwards. The scrolls are applied to the front cells
+// and their hashes. Returns the end of what was encoded.
+char *_tui_encode_scrolls(TERMINAL_CELL *front_cells, int width,
+                          int height_begin, int height_end,
+                          TUI_ROW_HASHES *hashes, TUI_SGR_STATE *sgr,
+                          char *out) {
+  const uint64_t *const rows = hashes->rows;
+  uint64_t *const front_rows = hashes->front_rows;
+  int *const table = hashes->table + 2 * height_begin;
+  const int table_size = 2 * (height_end - height_begin);
+  _tui_build_row_table(table, front_rows, height_begin, height_end);
+
+  char *const scrolls_begin = out;
+  int scrolls = 0;
+  int y = height_begin;
+  while (y < height_end && scrolls < _TUI_MAX_SCROLLS) {
+    const int source =
+        rows[y] == front_rows[y]
+            ? -1
+            : _tui_find_row(table, front_rows, table_size, rows[y]);
+    if (source == -1) {
+      ++y;
+      continue;
+    }
+    int size = 1;
+    while (y + size < height_end && source + size < height_end &&
+           rows[y + size] == front_rows[source + size]) {
+      ++size;
+    }
+
+    // the scroll region is where the block is and where it goes, rows
+    // scrolled out of it are lost and the uncovered ones are blank
+    const int top = y < source ? y : source;
+    const int bottom = (y < source ? source : y) + size;
+    const int shift = source - y;  // > 0 scrolls up
+    const int distance = shift > 0 ? shift : -shift;
+    int gain = 0;
+    for (int row = top; row < bottom; ++row) {
+      const int from = row + shift;
+      gain += from >= top && from < bottom && rows[row] == front_rows[from];
+      gain -= rows[row] == front_rows[row];
+    }
+    if (gain <= 0) {
+      ++y;
+      continue;
+    }
+
+    // the default colors so the uncovered rows are blank like
+    // _TUI_EMPTY_CELL
+    out = _tui_encode_sgr(out, &_TUI_EMPTY_CELL, NULL, 0, sgr);
+    *out++ = '\033';
+    *out++ = '[';
+    out = _tui_encode_uint(out, top + 1);
+    *out++ = ';';
+    out = _tui_encode_uint(out, bottom);
+    *out++ = 'r';
+    out = _tui_encode_csi(out, distance, shift > 0 ? 'S' : 'T');
+
+    const int kept = bottom - top - distance;
+    const int kept_begin = shift > 0 ? top : top + distance;
+    const int uncovered_begin = shift > 0 ? top + kept : top;
+    memmove(front_cells + (size_t)kept_begin * width,
+            front_cells + (size_t)(kept_begin + shift) * width,
+            (size_t)kept * width * sizeof(TERMINAL_CELL));
+    memmove(front_rows + kept_begin, front_rows + kept_begin + shift,
+            kept * sizeof(*front_rows));
+    _tui_fill_cells(front_cells + (size_t)uncovered_begin * width,
+                    (size_t)distance * width);
+    const uint64_t empty_row =
+        _tui_hash_row(front_cells + (size_t)uncovered_begin * width, width);
+    for (int row = uncovered_begin; row < uncovered_begin + distance; ++row) {
+      front_rows[row] = empty_row;
+    }
+    _tui_build_row_table(table, front_rows, height_begin, height_end);
+    ++scrolls;
+    y += size;
+  }
+  if (out != scrolls_begin) {
+    *out++ = '\033';  // whole screen as the scroll region again
+    *out++ = '[';
+    *out++ = 'r';
+  }
+  return out;
+}
+
+// Encodes the cells of rows [height_begin, height_end) that differ from the
+// front cells, or all of them if the front cells are not valid, to out and
+// copies them to the front cells. Rows that only moved are scrolled into place
+// first. Returns the end of what was encoded and adds the number of encoded
+// cells to cells_changed.
+char *_tui_encode_rows(const TERMINAL_CELL *cells, TERMINAL_CELL *front_cells,
+                       bool is_front_valid, const TUI_PALETTE *palette,
+                       const TUI_CLUSTERS *clusters,
+                       unsigned int terminal_features, int width,
+                       int height_begin, int height_end,
+                       TUI_ROW_HASHES *row_hashes, char *out,
+                       size_t *cells_changed) {
+  if (is_front_valid) {
+    // only the rows from the first to the last changed one are looked at
+    while (height_begin < height_end &&
+           _tui_row_equals(cells, front_cells, width, height_begin)) {
+      ++height_begin;
+    }
+    while (height_end > height_begin &&
+           _tui_row_equals(cells, front_cells, width, height_end - 1)) {
+      --height_end;
+    }
+  }
+  for (int y = height_begin; y < height_end; ++y) {
+    row_hashes->rows[y] = _tui_hash_row(cells + (size_t)y * width, width);
+  }
+  // the terminal's colors are not known here, so the first emitted cell
+  // always sets them
+  TUI_SGR_STATE sgr = {.color = COLOR_NO_COLOR,
+                       .background_color = COLOR_NO_COLOR};
+
+  // a scroll only pays off when more than a single row changed
+  if (is_front_valid && height_end - height_begin > 1) {
+    out = _tui_encode_scrolls(front_cells, width, height_begin, height_end,
+                              row_hashes, &sgr, out);
+  }
+  // the front hashes are kept up to date along with the front cells, so only
+  // the rows that changed are hashed per frame
+  memcpy(row_hashes->front_rows + height_begin, row_hashes->rows + height_begin,
+         (height_end - height_begin) * sizeof(*row_hashes->rows));
+
+  // bits of a cell that take an escape sequence to change
+  const TERMINAL_CELL attribute_bits = {.color = -1, .background_color = -1};
+  const uint64_t attribute_mask = _tui_cell_bits(&attribute_bits);
+
+  for (int y = height_begin; y < height_end; ++y) {
+    const TERMINAL_CELL *const row = cells + (size_t)y * width;
+    TERMINAL_CELL *const front_row = front_cells + (size_t)y * width;
+    int x = 0;
+    int end = width;
+    if (is_front_valid) {
+      x = _tui_cell_kernels.first_difference(row, front_row, width);
+      if (x == width) {
+        continue;
+      }
+      end = _tui_cell_kernels.last_difference(row, front_row, width);
+    }
+
+    int cursor_x = -1;  // not on this row yet
+    while (x < end) {
+      // a span of changed cells, the cursor is only moved to its start
+      int span_end = end;
+      if (is_front_valid) {
+        x += _tui_cell_kernels.first_difference(row + x, front_row + x,
+                                                end - x);
+        span_end = x + _tui_cell_kernels.first_equal(row + x, front_row + x,
+                                                     end - x);
+        // unchanged cells in between are written again when that is shorter
+        // than moving the cursor over them and takes no color change
+        while (span_end < end) {
+          const int gap = _tui_cell_kernels.first_difference(
+              row + span_end, front_row + span_end, end - span_end);
+          if (gap > 3 + _tui_uint_size(gap) ||
+              _tui_cell_kernels.run_length(row + span_end - 1,
+                                           attribute_mask, gap + 1) <=
+                  (size_t)gap) {
+            break;
+          }
+          span_end += gap;
+          span_end += _tui_cell_kernels.first_equal(
+              row + span_end, front_row + span_end, end - span_end);
+        }
+        // wide characters are written whole, from their first cell
+        while (x > 0 && _tui_is_continuation(row + x)) {
+          --x;
+        }
+        while (span_end < width && _tui_is_continuation(row + span_end)) {
+          ++span_end;
+        }
+      }
+      memcpy(front_row + x, row + x, (span_end - x) * sizeof(TERMINAL_CELL));
+      *cells_changed += span_end - x;
+
+      while (x < span_end) {
+        // the colors are only looked at once per run of the same colors
+        const int run_end =
+            x + _tui_cell_kernels.run_length(row + x, attribute_mask,
+                                             span_end - x);
+        out = _tui_encode_sgr(out, row + x, palette, terminal_features, &sgr);
+        while (x < run_end) {
+          // most text has no repeated characters, so the run is only
+          // measured where two of them repeat
+          int count = 1;
+          if (x + 1 < run_end && row[x + 1].text == row[x].text) {
+            count = _tui_cell_kernels.run_length(row + x, UINT64_MAX,
+                                                 run_end - x);
+          }
+          if (count >= _TUI_MIN_REPEAT) {
+            out = _tui_encode_repeat(out, row + x, count, x, y, width,
+                                     x + count == span_end, clusters,
+                                     terminal_features, &cursor_x);
+            x += count;
+            continue;
+          }
+          if (cursor_x != x) {
+            out = _tui_encode_move(out, x, y, cursor_x);
+          }
+          for (cursor_x = x + count; x < cursor_x; ++x) {
+            out = _tui_encode_text(out, row + x, clusters);
+          }
+        }
+      }
+    }
+  }
+  return out;
+}
+
+// Encodes the rows of damage, or all of them when the front cells are not
+// valid, as the other cells can't differ from the front
+void _tui_draw_cells_to_terminal(TUI *tui, const TUI_RECT *damage) {
+  // save and restore of the cursor
+  const size_t size_of_frame = 2 + 2;
+
+  _tui_buffer_reserve(&tui->output, _tui_max_encoded_size(tui->cells_length) +
+                                        size_of_frame);
+  char *const begin = tui->output.data;
+  char *out = begin;
+
+  *out++ = '\033';  // save cursor
+  *out++ = '7';
+  char *const content_begin = out;
+
+  const long int start = nano_time();
+  size_t cells_changed = 0;
+  int height_begin = 0;
+  int height_end = tui_get_height(tui);
+  if (tui->front_cells_valid) {
+    height_begin = damage->height_begin;
+    height_end = damage->height_end;
+  }
+  _tui_reserve_row_hashes(&tui->row_hashes, tui_get_height(tui));
+  out = _tui_encode_rows(tui->cells, tui->front_cells, tui->front_cells_valid,
+                         &tui->palette, &tui->clusters,
+                         tui->terminal_features, tui_get_width(tui),
+                         height_begin, height_end,
+                         &tui->row_hashes, out, &cells_changed);
+  tui->front_cells_valid = true;
+  const long int time = _tui_stage_end(&tui->stats, TUI_STAGE_ENCODE, start);
+  _tui_stat_add(&tui->stats.counters[TUI_COUNTER_CELLS_CHANGED],
+                cells_changed);
+
+  if (out == content_begin) {
+    _tui_sink_flush(&tui->sink, NULL, 0);
+    return;
+  }
+
+  *out++ = '\033';  // restore cursor
+  *out++ = '8';
+  tui->output.size = out - begin;
+
+  const size_t written = _tui_sink_flush(&tui->sink, begin, tui->output.size);
+  _tui_stage_end(&tui->stats, TUI_STAGE_WRITE, time);
+  _tui_stat_add(&tui->stats.counters[TUI_COUNTER_BYTES_WRITTEN], written);
+}
+
+bool tui_widget_array_eqauls(const WIDGET_ARRAY *restrict left,
+                             const WIDGET_ARRAY *restrict right) {
+  if (left->size != right->size) {
+    return false;
+  }
+  for (size_t i = 0; i < left->size; ++i) {
+    if (!tui_widget_eqauls(left->widgets[i], right->widgets[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Widgets that differ almost always differ in their structural hash, so
+// they are told apart in O(1). Equal hashes are only trusted after the
+// widgets themselves compare equal, as a collision would leave the screen
+// showing the wrong tree.
+bool tui_widget_eqauls(const WIDGET *restrict left,
+                       const WIDGET *restrict right) {
+  if (left == NULL || right == NULL) {
+    return left == NULL && right == NULL;
+  } else if (left == right) {
+    return true;
+  } else if (left->hash != right->hash ||
+             !_tui_widget_shallow_equals(left, right)) {
+    return false;
+  }
+  switch (left->type) {
+    case WIDGET_TYPE_TEXT:
+    case WIDGET_TYPE_LOG_VIEW:
+      return true;
+    case WIDGET_TYPE_BUTTON:
+      return tui_widget_eqauls(
+          ((const BUTTON_METADATA *)left->metadata)->child,
+          ((const BUTTON_METADATA *)right->metadata)->child);
+    case WIDGET_TYPE_COLUMN:
+    case WIDGET_TYPE_ROW:
+    case WIDGET_TYPE_SCROLL_VIEW:
+      // column, row and scroll view metadata start with their children
+      return tui_widget_array_eqauls(
+          ((const COLUMN_METADATA *)left->metadata)->children,
+          ((const COLUMN_METADATA *)right->metadata)->children);
+    case WIDGET_TYPE_BOX:
+      return tui_widget_eqauls(((const BOX_METADATA *)left->metadata)->child,
+                               ((const BOX_METADATA *)right->metadata)->child);
+    default:
+      fprintf(stderr, "widget type '%d' went wrong in tui_widget_eqauls",
+              left->type);
+      exit(1);
+  }
+}
+
+const uint64_t _TUI_HASH_SEED = 0x9E3779B97F4A7C15ULL;
+
+uint64_t _tui_hash_combine(uint64_t hash, uint64_t value) {
+  hash ^= value + _TUI_HASH_SEED + (hash << 6) + (hash >> 2);
+  hash *= 0xBF58476D1CE4E5B9ULL;
+  return hash ^ (hash >> 31);
+}
+
+uint64_t _tui_hash_bytes(uint64_t hash, const char *bytes, size_t size) {
+  hash = _tui_hash_combine(hash, size);
+  for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    hash = _tui_hash_combine(hash, word);
+    bytes += sizeof(uint64_t);
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, bytes, size);
+  return _tui_hash_combine(hash, tail);
+}
+
+uint64_t _tui_hash_widget_array(uint64_t hash,
+                                const WIDGET_ARRAY *widget_array) {
+  hash = _tui_hash_combine(hash, widget_array->size);
+  for (size_t i = 0; i < widget_array->size; ++i) {
+    const WIDGET *child = widget_array->widgets[i];
+    hash = _tui_hash_combine(hash, child == NULL ? 0 : child->hash);
+  }
+  return hash;
+}
+
+// children are hashed when they are made, so this is O(1) per child
+uint64_t _tui_hash_widget(const WIDGET *widget) {
+  uint64_t hash = _tui_hash_combine(_TUI_HASH_SEED, widget->type);
+  switch (widget->type) {
+    case WIDGET_TYPE_TEXT: {
+      const TEXT_METADATA *metadata = widget->metadata;
+      hash = _tui_hash_combine(hash, (uint64_t)metadata->color);
+      hash = _tui_hash_combine(hash, metadata->hash);
+      hash = _tui_hash_combine(hash, metadata->style.wrap);
+      hash = _tui_hash_combine(hash, (uint64_t)metadata->style.tab_width);
+      hash = _tui_hash_combine(hash, metadata->style.has_ellipsis);
+    } break;
+    case WIDGET_TYPE_BUTTON: {
+      const BUTTON_METADATA *metadata = widget->metadata;
+      hash = _tui_hash_combine(hash, (uintptr_t)metadata->callback);
+      hash = _tui_hash_combine(hash, (uintptr_t)metadata->context);
+      hash = _tui_hash_combine(
+          hash, metadata->child == NULL ? 0 : metadata->child->hash);
+    } break;
+    case WIDGET_TYPE_COLUMN: {
+      const COLUMN_METADATA *metadata = widget->metadata;
+      hash = _tui_hash_widget_array(hash, metadata->children);
+    } break;
+    case WIDGET_TYPE_ROW: {
+      const ROW_METADATA *metadata = widget->metadata;
+      hash = _tui_hash_widget_array(hash, metadata->children);
+    } break;
+    case WIDGET_TYPE_BOX: {
+      const BOX_METADATA *metadata = widget->metadata;
+      hash = _tui_hash_combine(hash, (uint64_t)metadata->width);
+      hash = _tui_hash_combine(hash, (uint64_t)metadata->height);
+      hash = _tui_hash_combine(hash, (uint64_t)metadata->color);
+      hash = _tui_hash_combine(
+          hash, metadata->child == NULL ? 0 : metadata->child->hash);
+    } break;
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      const SCROLL_VIEW_METADATA *metadata = widget->metadata;
+      hash = _tui_hash_combine(hash, (uintptr_t)metadata->state);
+      hash = _tui_hash_combine(hash, metadata->offset);
+      hash = _tui_hash_combine(hash, metadata->item_count);
+      hash = _tui_hash_combine(hash, (uintptr_t)metadata->item_builder);
+      hash = _tui_hash_combine(hash, (uintptr_t)metadata->context);
+      hash = _tui_hash_widget_array(hash, metadata->children);
+    } break;
+    case WIDGET_TYPE_LOG_VIEW: {
+      // bytes of a line never change once appended, so the lines identify
+      // the text
+      const LOG_VIEW_METADATA *metadata = widget->metadata;
+      hash = _tui_hash_combine(hash, (uintptr_t)metadata->log);
+      hash = _tui_hash_combine(hash, metadata->end_line);
+      hash = _tui_hash_combine(hash, metadata->last_size);
+      hash = _tui_hash_combine(hash, (uint64_t)metadata->color);
+    } break;
+    default:
+      fprintf(stderr, "Type error '%d' in _tui_hash_widget\n", widget->type);
+      exit(1);
+  }
+  return hash;
+}
+
+void _tui_render_band(TUI *tui, TUI_BAND *band) {
+  const TUI_WORKERS *workers = &tui->workers;
+  const int width = tui_get_width(tui);
+  TUI_RECT rows = {0, width, band->height_begin, band->height_end};
+  TUI_RECT clip = workers->damage;
+  _tui_rect_clip(&clip, &rows);
+  long int time = nano_time();
+  if (!_tui_rect_is_empty(&clip)) {
+    _tui_clear_cells_in_rect(tui, &clip);
+    _tui_rasterize_widget(tui, workers->root_widget, 0, 0, &clip);
+    time = _tui_stage_end(&tui->stats, TUI_STAGE_RASTERIZE, time);
+  }
+
+  // only the damaged rows can differ from valid front cells
+  if (tui->front_cells_valid) {
+    rows = clip;
+    if (_tui_rect_is_empty(&rows)) {
+      rows.height_end = rows.height_begin;
+    }
+  }
+  const size_t cells = (size_t)width * (rows.height_end - rows.height_begin);
+  size_t cells_changed = 0;
+  _tui_buffer_reserve(&band->output, _tui_max_encoded_size(cells));
+  band->output.size =
+      _tui_encode_rows(tui->cells, tui->front_cells, tui->front_cells_valid,
+                       &tui->palette, &tui->clusters, tui->terminal_features,
+                       width,
+                       rows.height_begin, rows.height_end, &tui->row_hashes,
+                       band->output.data, &cells_changed) -
+      band->output.data;
+  _tui_stage_end(&tui->stats, TUI_STAGE_ENCODE, time);
+  _tui_stat_add(&tui->stats.counters[TUI_COUNTER_CELLS_CHANGED],
+                cells_changed);
+}
+
+// Renders bands of the current frame until none is left, with the mutex
+// locked on entry and on return
+void _tui_render_bands_locked(TUI *tui) {
+  TUI_WORKERS *workers = &tui->workers;
+  while (workers->next_band < workers->bands_size) {
+    TUI_BAND *band = &workers->bands[workers->next_band++];
+    pthread_mutex_unlock(&workers->mutex);
+    _tui_render_band(tui, band);
+    pthread_mutex_lock(&workers->mutex);
+    if (++workers->bands_done == workers->bands_size) {
+      pthread_cond_signal(&workers->done);
+    }
+  }
+}
+
+void *_tui_worker_main(void *arg) {
+  TUI *tui = arg;
+  TUI_WORKERS *workers = &tui->workers;
+  pthread_mutex_lock(&workers->mutex);
+  uint64_t generation = workers->generation;
+  while (true) {
+    while (!workers->is_stopping && workers->generation == generation) {
+      pthread_cond_wait(&workers->start, &workers->mutex);
+    }
+    if (workers->is_stopping) {
+      break;
+    }
+    generation = workers->generation;
+    _tui_render_bands_locked(tui);
+  }
+  pthread_mutex_unlock(&workers->mutex);
+  return NULL;
+}
+
+void _tui_stop_workers(TUI *tui) {
+  TUI_WORKERS *workers = &tui->workers;
+  if (workers->threads_size == 0) {
+    return;
+  }
+  pthread_mutex_lock(&workers->mutex);
+  workers->is_stopping = true;
+  pthread_cond_broadcast(&workers->start);
+  pthread_mutex_unlock(&workers->mutex);
+  for (int i = 0; i < workers->threads_size; ++i) {
+    pthread_join(workers->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&workers->mutex);
+  pthread_cond_destroy(&workers->start);
+  pthread_cond_destroy(&workers->done);
+  for (int i = 0; i < workers->bands_size; ++i) {
+    _tui_delete_buffer(&workers->bands[i].output);
+  }
+  free(workers->bands);
+  free(workers->threads);
+  *workers = (TUI_WORKERS){0};
+}
+
+void tui_use_workers(TUI *tui, int count) {
+  _tui_stop_workers(tui);
+  if (count <= 0) {
+    return;
+  }
+  TUI_WORKERS *workers = &tui->workers;
+  pthread_mutex_init(&workers->mutex, NULL);
+  pthread_cond_init(&workers->start, NULL);
+  pthread_cond_init(&workers->done, NULL);
+  workers->bands_size = count + 1;
+  workers->bands = calloc(workers->bands_size, sizeof(TUI_BAND));
+  workers->threads = malloc(count * sizeof(pthread_t));
+  for (int i = 0; i < count; ++i) {
+    if (pthread_create(&workers->threads[i], NULL, _tui_worker_main, tui) !=
+        0) {
+      fprintf(stderr, "can't start worker thread\n");
+      exit(1);
+    }
+    workers->threads_size = i + 1;
+  }
+}
+
+// Does what clearing and rasterizing the damage and then
+// _tui_draw_cells_to_terminal do, one band of rows per thread. The bands are
+// written out in order with a single write.
+void _tui_render_in_bands(TUI *tui, const WIDGET *root_widget,
+                          const TUI_RECT *damage) {
+  TUI_WORKERS *workers = &tui->workers;
+  const int height = tui_get_height(tui);
+
+  pthread_mutex_lock(&workers->mutex);
+  for (int i = 0; i < workers->bands_size; ++i) {
+    workers->bands[i].height_begin = height * i / workers->bands_size;
+    workers->bands[i].height_end = height * (i + 1) / workers->bands_size;
+  }
+  workers->root_widget = root_widget;
+  workers->damage = *damage;
+  _tui_reserve_row_hashes(&tui->row_hashes, tui_get_height(tui));
+  workers->next_band = 0;
+  workers->bands_done = 0;
+  ++workers->generation;
+  pthread_cond_broadcast(&workers->start);
+  _tui_render_bands_locked(tui);
+  while (workers->bands_done != workers->bands_size) {
+    pthread_cond_wait(&workers->done, &workers->mutex);
+  }
+  pthread_mutex_unlock(&workers->mutex);
+  tui->front_cells_valid = true;
+
+  size_t size = 0;
+  for (int i = 0; i < workers->bands_size; ++i) {
+    size += workers->bands[i].output.size;
+  }
+  if (size == 0) {
+    _tui_sink_flush(&tui->sink, NULL, 0);
+    return;
+  }
+  _tui_buffer_reserve(&tui->output, size + 2 + 2);
+  char *out = tui->output.data;
+  *out++ = '\033';  // save cursor
+  *out++ = '7';
+  for (int i = 0; i < workers->bands_size; ++i) {
+    memcpy(out, workers->bands[i].output.data, workers->bands[i].output.size);
+    out += workers->bands[i].output.size;
+  }
+  *out++ = '\033';  // restore cursor
+  *out++ = '8';
+  tui->output.size = out - tui->output.data;
 
-void tui_start_app(TUI *tui, WIDGET_BUILDER widget_builder, int fps) {
-  tui_main_loop(tui, widget_builder, fps);
+  const long int start = nano_time();
+  const size_t written =
+      _tui_sink_flush(&tui->sink, tui->output.data, tui->output.size);
+  _tui_stage_end(&tui->stats, TUI_STAGE_WRITE, start);
+  _tui_stat_add(&tui->stats.counters[TUI_COUNTER_BYTES_WRITTEN], written);
 }
 
-void _tui_draw_widget_to_cells(TUI *tui, const WIDGET *widget, int width_begin,
-                               int width_end, int height_begin, int height_end,
-                               int *child_width, int *child_height) {
-  switch (widget->type) {
-    case WIDGET_TYPE_TEXT: {
-      const TEXT_METADATA *metadata = widget->metadata;
-      const int width_diff = width_end - width_begin;
-      const size_t text_len = strlen(metadata->text);
-      size_t inserted_index = 0;
-      int height = height_begin;
-      int max_width = width_begin;
-      for (; height < height_end; ++height) {
-        for (int j = 0; j < width_diff; ++j) {
-        START_OF_HORIZONTAL_LOOP:
-          if (inserted_index < text_len) {
-            const int x = width_begin + j;
-            const int y = height;
-            const char c = metadata->text[inserted_index];
-            inserted_index += 1;
-            if (c == '\n') {// do for other spaces
-              height += 1;
-              j = 0;
-              goto START_OF_HORIZONTAL_LOOP;
-            } else {
-              if (max_width < x) {
-                max_width = x;
-              }
-              _tui_set_cell_color(tui, x, y, metadata->color);
-              _tui_set_cell_char(tui, x, y, c);
-            }
-          } else {
-            goto END_OF_TEXT;
-          }
-        }
-      }
-    END_OF_TEXT:
-      *child_height = height + 1;
-      *child_width = max_width + 1;
-    } break;
-    case WIDGET_TYPE_BUTTON: {
-      const BUTTON_METADATA *metadata = widget->metadata;
-      if (metadata->child != NULL) {
-        _tui_draw_widget_to_cells(tui, metadata->child, width_begin, width_end,
-                                  height_begin, height_end, child_width,
-                                  child_height);
-        for (int i = width_begin; i < *child_width; ++i) {
-          for (int j = height_begin; j < *child_height; ++j) {
-            _tui_set_cell_on_click_callback(tui, i, j, metadata->callback);
-          }
-        }
-      }
-    } break;
-    case WIDGET_TYPE_COLUMN: {
-      const COLUMN_METADATA *metadata = widget->metadata;
-      *child_width = width_begin;
-      *child_height = height_begin;
-      for (size_t i = 0; i < metadata->children->size; ++i) {
-        const WIDGET *child = metadata->children->widgets[i];
-        int width_temp;
-        _tui_draw_widget_to_cells(tui, child, width_begin, width_end,
-                                  *child_height, height_end, &width_temp,
-                                  child_height);
-        if (width_temp > *child_width) {
-          *child_width = width_temp;
-        }
-      }
-    } break;
-    case WIDGET_TYPE_ROW: {
-      const ROW_METADATA *metadata = widget->metadata;
-      *child_width = width_begin;
-      *child_height = height_begin;
-      for (size_t i = 0; i < metadata->children->size; ++i) {
-        const WIDGET *child = metadata->children->widgets[i];
-        int height_temp;
-        _tui_draw_widget_to_cells(tui, child, *child_width, width_end,
-                                  height_begin, height_end, child_width,
-                                  &height_temp);
-        if (height_temp > *child_height) {
-          *child_height = height_temp;
-        }
-      }
-    } break;
-    case WIDGET_TYPE_BOX: {
-      const BOX_METADATA *metadata = widget->metadata;
+// set in TUI_PIPELINE.middle while the middle frame is newer than the front
+const unsigned int _TUI_FRAME_FRESH = 4;
 
-      if (metadata->width != MIN_WIDTH && metadata->width != MAX_WIDTH) {
-        width_end = metadata->width + width_begin >= width_end
-                        ? width_end
-                        : metadata->width + width_begin;
-      }
-      if (metadata->height != MIN_HEIGHT && metadata->height != MAX_HEIGHT) {
-        height_end = metadata->height + height_begin >= height_end
-                         ? height_end
-                         : metadata->height + height_begin;
-      }
+void _tui_write_frame(TUI_PIPELINE *pipeline, const TUI_FRAME *frame) {
+  const size_t cells_length = (size_t)frame->width * frame->height;
+  const bool is_front_valid = !frame->is_repaint &&
+                              pipeline->front_width == frame->width &&
+                              pipeline->front_height == frame->height;
+  if (cells_length > pipeline->front_cells_capacity) {
+    free(pipeline->front_cells);
+    pipeline->front_cells = malloc(cells_length * sizeof(TERMINAL_CELL));
+    pipeline->front_cells_capacity = cells_length;
+  }
+  pipeline->front_width = frame->width;
+  pipeline->front_height = frame->height;
 
-      if (metadata->child != NULL) {
-        int temp_width, temp_height;
-        _tui_draw_widget_to_cells(tui, metadata->child, width_begin, width_end,
-                                  height_begin, height_end, &temp_width,
-                                  &temp_height);
-        if (metadata->width == MIN_WIDTH) {
-          width_end = temp_width;
-        }
-        if (metadata->height == MIN_HEIGHT) {
-          height_end = temp_height;
-        }
-      }
+  _tui_buffer_reserve(&pipeline->output,
+                      _tui_max_encoded_size(cells_length) + 2 + 2);
+  char *const begin = pipeline->output.data;
+  char *out = begin;
+  *out++ = '\033';  // save cursor
+  *out++ = '7';
+  char *const content_begin = out;
+  const long int start = nano_time();
+  size_t cells_changed = 0;
+  _tui_reserve_row_hashes(&pipeline->row_hashes, frame->height);
+  out = _tui_encode_rows(frame->cells, pipeline->front_cells, is_front_valid,
+                         pipeline->palette, pipeline->clusters,
+                         frame->terminal_features,
+                         frame->width, 0, frame->height, &pipeline->row_hashes,
+                         out, &cells_changed);
+  const long int time =
+      _tui_stage_end(pipeline->stats, TUI_STAGE_ENCODE, start);
+  _tui_stat_add(&pipeline->stats->counters[TUI_COUNTER_CELLS_CHANGED],
+                cells_changed);
+  if (out == content_begin) {
+    _tui_sink_flush(pipeline->sink, NULL, 0);
+    return;
+  }
+  *out++ = '\033';  // restore cursor
+  *out++ = '8';
+  pipeline->output.size = out - begin;
 
-      for (int y = height_begin; y < height_end; ++y) {
-        for (int x = width_begin; x < width_end; ++x) {
-          _tui_set_cell_background_color_if_not_set(tui, x, y, metadata->color);
-        }
-      }
+  const size_t written =
+      _tui_sink_flush(pipeline->sink, begin, pipeline->output.size);
+  _tui_stage_end(pipeline->stats, TUI_STAGE_WRITE, time);
+  _tui_stat_add(&pipeline->stats->counters[TUI_COUNTER_BYTES_WRITTEN],
+                written);
+}
 
-      *child_width = width_end;
-      *child_height = height_end;
-    } break;
-    default:
-      fprintf(stderr, "widget type '%d' went wrong in _tui_draw_widget",
-              widget->type);
-      exit(1);
+void *_tui_output_thread_main(void *arg) {
+  TUI_PIPELINE *pipeline = arg;
+  while (true) {
+    sem_wait(&pipeline->wake);
+    // what was published before stopping is still written
+    if (atomic_load(&pipeline->middle) & _TUI_FRAME_FRESH) {
+      pipeline->front =
+          atomic_exchange(&pipeline->middle, pipeline->front) &
+          ~_TUI_FRAME_FRESH;
+      _tui_write_frame(pipeline, &pipeline->frames[pipeline->front]);
+    } else if (atomic_load(&pipeline->is_stopping)) {
+      break;
+    }
   }
+  return NULL;
 }
 
-void _tui_move_to_start_in_str(char *str) { strcpy(str, "\033[;H"); }
+// Copies the cells into the back frame and swaps it into the middle for the
+// output thread
+void _tui_publish_frame(TUI *tui) {
+  TUI_PIPELINE *pipeline = &tui->pipeline;
+  TUI_FRAME *frame = &pipeline->frames[pipeline->back];
+  if (tui->cells_length > frame->cells_capacity) {
+    free(frame->cells);
+    frame->cells = malloc(tui->cells_length * sizeof(TERMINAL_CELL));
+    frame->cells_capacity = tui->cells_length;
+  }
+  memcpy(frame->cells, tui->cells, tui->cells_length * sizeof(TERMINAL_CELL));
+  frame->width = tui_get_width(tui);
+  frame->height = tui_get_height(tui);
+  const bool is_repaint = !tui->front_cells_valid;
+  frame->terminal_features = tui->terminal_features;
+  tui->front_cells_valid = true;
 
-int _tui_get_background_color_ascii(COLOR color) {
-  if (color == COLOR_NO_COLOR) {
-    return 0;
-  } else if (color == COLOR_RESET) {
-    return printf("\033[%dm", COLOR_RESET);
+  // A frame the output thread never took may have needed a repaint, which
+  // the frame replacing it then does. The frame is only seen by the output
+  // thread once it is swapped in, so the flag is set right before that.
+  unsigned int old_middle = atomic_load(&pipeline->middle);
+  do {
+    frame->is_repaint =
+        is_repaint ||
+        ((old_middle & _TUI_FRAME_FRESH) &&
+         pipeline->frames[old_middle & ~_TUI_FRAME_FRESH].is_repaint);
+  } while (!atomic_compare_exchange_weak(&pipeline->middle, &old_middle,
+                                         pipeline->back | _TUI_FRAME_FRESH));
+  pipeline->back = old_middle & ~_TUI_FRAME_FRESH;
+  sem_post(&pipeline->wake);
+}
+
+void _tui_stop_output_thread(TUI *tui) {
+  TUI_PIPELINE *pipeline = &tui->pipeline;
+  if (!pipeline->is_running) {
+    return;
+  }
+  atomic_store(&pipeline->is_stopping, true);
+  sem_post(&pipeline->wake);
+  pthread_join(pipeline->thread, NULL);
+  sem_destroy(&pipeline->wake);
+  for (int i = 0; i < 3; ++i) {
+    free(pipeline->frames[i].cells);
+  }
+  free(pipeline->front_cells);
+  _tui_delete_row_hashes(&pipeline->row_hashes);
+  _tui_delete_buffer(&pipeline->output);
+  *pipeline = (TUI_PIPELINE){0};
+  // the output thread's view of the terminal is gone with it
+  tui->front_cells_valid = false;
+}
+
+void tui_use_output_thread(TUI *tui, bool use_output_thread) {
+  _tui_stop_output_thread(tui);
+  if (!use_output_thread) {
+    return;
   }
-  return printf("\033[%dm", color + 40);
+  TUI_PIPELINE *pipeline = &tui->pipeline;
+  *pipeline = (TUI_PIPELINE){0};
+  atomic_init(&pipeline->middle, 1);
+  pipeline->back = 0;
+  pipeline->front = 2;
+  pipeline->sink = &tui->sink;
+  pipeline->stats = &tui->stats;
+  pipeline->palette = &tui->palette;
+  pipeline->clusters = &tui->clusters;
+  atomic_init(&pipeline->is_stopping, false);
+  sem_init(&pipeline->wake, 0, 0);
+  if (pthread_create(&pipeline->thread, NULL, _tui_output_thread_main,
+                     pipeline) != 0) {
+    fprintf(stderr, "can't start output thread\n");
+    exit(1);
+  }
+  pipeline->is_running = true;
+  // the terminal was drawn by this thread so far
+  tui->front_cells_valid = false;
 }
 
-void _tui_draw_cells_to_terminal(TUI *tui) {
-  const size_t size_of_cell = 5 + 5 + sizeof(char) + 5;
-  const size_t size = tui->cells_length * size_of_cell;
-  char str[(size + 2) * sizeof(char) + 1];
+void _tui_use_sink(TUI *tui, TUI_SINK_TYPE type, int fd) {
+  TUI_SINK *sink = &tui->sink;
+  _tui_sink_flush(sink, _TUI_TERMINAL_RESET, sizeof(_TUI_TERMINAL_RESET) - 1);
+  pthread_mutex_lock(&sink->mutex);
+  sink->type = type;
+  sink->fd = fd;
+  sink->pending.size = 0;
+  _tui_sink_append(sink, _TUI_TERMINAL_SETUP, sizeof(_TUI_TERMINAL_SETUP) - 1);
+  pthread_mutex_unlock(&sink->mutex);
+  // nothing of the current frame is on the new sink yet
+  tui->front_cells_valid = false;
+}
 
-  _tui_move_to_start_in_str(str);
+void tui_use_fd_sink(TUI *tui, int fd) { _tui_use_sink(tui, TUI_SINK_FD, fd); }
 
-  char cell_str[5];
+void tui_use_memory_sink(TUI *tui) { _tui_use_sink(tui, TUI_SINK_MEMORY, -1); }
 
-  COLOR last_color = COLOR_NO_COLOR;
-  COLOR last_background_color = COLOR_NO_COLOR;
+char *tui_take_sink_data(TUI *tui, size_t *size) {
+  TUI_SINK *sink = &tui->sink;
+  pthread_mutex_lock(&sink->mutex);
+  char *data = NULL;
+  *size = 0;
+  if (sink->type == TUI_SINK_MEMORY) {
+    data = sink->pending.data;
+    *size = sink->pending.size;
+    sink->pending = (TUI_BUFFER){0};
+  }
+  pthread_mutex_unlock(&sink->mutex);
+  return data;
+}
 
-  for (size_t i = 0; i < tui->cells_length; ++i) {
-    const TERMINAL_CELL cell = tui->cells[i];
+void tui_flush(TUI *tui) { _tui_sink_flush(&tui->sink, NULL, 0); }
 
-    if (last_color != cell.color ||
-        last_background_color != cell.background_color) {
-      sprintf(cell_str, "\033[%dm", COLOR_RESET);
-      strcat(str, cell_str);
-      last_color = cell.color;
-      last_background_color = cell.background_color;
-      if (cell.color == COLOR_RESET || cell.color == COLOR_NO_COLOR) {
-        sprintf(cell_str, "\033[%dm", COLOR_RESET);
-      } else {
-        sprintf(cell_str, "\033[%dm", cell.color + 30);
-      }
-      strcat(str, cell_str);
+void tui_use_frame_arena(TUI *tui, bool use_frame_arena) {
+  tui->use_frame_arena = use_frame_arena;
+}
 
-      if (cell.background_color == COLOR_RESET ||
-          cell.background_color == COLOR_NO_COLOR) {
-        sprintf(cell_str, "\033[%dm", COLOR_RESET);
-      } else {
-        sprintf(cell_str, "\033[%dm", cell.background_color + 40);
-      }
-      strcat(str, cell_str);
-    }
-    strncat(str, &cell.c, 1);
+WIDGET *_tui_build_widget(TUI *tui, WIDGET_BUILDER widget_builder,
+                          void *context, TUI_ARENA **arena) {
+  *arena = NULL;
+  if (tui->use_frame_arena) {
+    // the retained tree may live in one of the arenas, so build in the other
+    *arena = tui->root_widget_arena == &tui->frame_arenas[0]
+                 ? &tui->frame_arenas[1]
+                 : &tui->frame_arenas[0];
+    _tui_arena_reset(*arena);
   }
-  const int len = strlen(str);
 
-  write(STDOUT_FILENO, str, len);
-}
+  TUI_ARENA *const previous_arena = _tui_active_arena;
+  _tui_active_arena = *arena;
+  WIDGET *widget = widget_builder(tui, context);
+  _tui_active_arena = previous_arena;
 
-int kbhit() {
-  struct timeval tv = {0L, 0L};
-  fd_set fds;
-  FD_ZERO(&fds);
-  FD_SET(0, &fds);
-  return select(1, &fds, NULL, NULL, &tv) > 0;
+  return widget;
 }
 
-bool tui_widget_array_eqauls(const WIDGET_ARRAY *restrict left,
-                             const WIDGET_ARRAY *restrict right) {
-  if (left->size != right->size) {
-    return false;
-  }
-  for (size_t i = 0; i < left->size; ++i) {
-    if (!tui_widget_eqauls(left->widgets[i], right->widgets[i])) {
-      return false;
+void _tui_render_frame(TUI *tui, WIDGET_BUILDER widget_builder,
+                       void *context) {
+  tui_refresh(tui);
+  ++_tui_layout_frame;
+  TUI_STATS *stats = &tui->stats;
+  long int time = nano_time();
+  const uint64_t widgets_allocated = _tui_widgets_allocated;
+  TUI_ARENA *root_widget_arena;
+  WIDGET *root_widget = _tui_build_widget(tui, widget_builder, context,
+                                          &root_widget_arena);
+  _tui_stat_add(&stats->counters[TUI_COUNTER_WIDGETS_ALLOCATED],
+                _tui_widgets_allocated - widgets_allocated);
+  time = _tui_stage_end(stats, TUI_STAGE_BUILD, time);
+  WIDGET *old_root_widget = tui->root_widget;
+  const TUI_RECT screen = {
+      .width_begin = 0,
+      .width_end = tui_get_width(tui),
+      .height_begin = 0,
+      .height_end = tui_get_height(tui),
+  };
+
+  // the trees are compared once, reconcile hands it on to their subtrees
+  const bool is_root_equal = tui_widget_eqauls(old_root_widget, root_widget);
+  if (old_root_widget != NULL) {
+    if (is_root_equal && tui->front_cells_valid &&
+        old_root_widget->layout.available_width == screen.width_end &&
+        old_root_widget->layout.available_height == screen.height_end) {
+      // nothing changed, the terminal already shows this frame
+      tui_delete_widget(root_widget);
+      _tui_stage_end(stats, TUI_STAGE_LAYOUT, time);
+      return;
     }
   }
-  return true;
-}
 
-bool tui_widget_eqauls(const WIDGET *restrict left,
-                       const WIDGET *restrict right) {
-  if (left == NULL || right == NULL) {
-    return left == NULL && right == NULL;
+  // text layouts are kept in the arena of the tree they were made for
+  TUI_ARENA *const previous_arena = _tui_active_arena;
+  _tui_active_arena = root_widget_arena;
+  if (old_root_widget != NULL) {
+    _tui_reconcile_widget(old_root_widget, root_widget, is_root_equal);
   }
-  if (left->type != right->type) {
-    return false;
+  int width, height;
+  _tui_measure_widget(root_widget, screen.width_end, screen.height_end, &width,
+                      &height);
+  _tui_active_arena = previous_arena;
+  root_widget->layout.x = 0;
+  root_widget->layout.y = 0;
+
+  _tui_hit_index_clear(&tui->hit_index);
+  _tui_hit_index_clear(&tui->scroll_index);
+  _tui_collect_hit_targets(&tui->hit_index, &tui->scroll_index, root_widget, 0,
+                           0, &screen);
+
+  TUI_RECT damage = screen;
+  if (old_root_widget != NULL) {
+    damage = tui->exposed;
+    _tui_collect_damage(old_root_widget, 0, 0, root_widget, 0, 0, &damage);
+    _tui_rect_clip(&damage, &screen);
   }
+  tui->exposed = (TUI_RECT){0};
+  time = _tui_stage_end(stats, TUI_STAGE_LAYOUT, time);
 
-  switch (left->type) {
-    case WIDGET_TYPE_TEXT: {
-      const TEXT_METADATA *left_data = left->metadata;
-      const TEXT_METADATA *right_data = right->metadata;
-      return left_data->color == right_data->color &&
-             strcmp(left_data->text, right_data->text) == 0;
-    } break;
-    case WIDGET_TYPE_BUTTON: {
-      const BUTTON_METADATA *left_data = left->metadata;
-      const BUTTON_METADATA *right_data = right->metadata;
-      return left_data->callback == right_data->callback &&
-             tui_widget_eqauls(left_data->child, right_data->child);
-    } break;
-    case WIDGET_TYPE_COLUMN: {
-      const COLUMN_METADATA *left_data = left->metadata;
-      const COLUMN_METADATA *right_data = right->metadata;
-      return tui_widget_array_eqauls(left_data->children, right_data->children);
-    } break;
-    case WIDGET_TYPE_ROW: {
-      const ROW_METADATA *left_data = left->metadata;
-      const ROW_METADATA *right_data = right->metadata;
-      return tui_widget_array_eqauls(left_data->children, right_data->children);
-    } break;
-    case WIDGET_TYPE_BOX: {
-      const BOX_METADATA *left_data = left->metadata;
-      const BOX_METADATA *right_data = right->metadata;
-      return left_data->width == right_data->width &&
-             left_data->height == right_data->height &&
-             left_data->color == right_data->color &&
-             tui_widget_eqauls(left_data->child, right_data->child);
-    } break;
-    default:
-      fprintf(stderr, "Type error '%d' in tui_delete_widget\n", left->type);
-      exit(1);
+  const bool is_drawn =
+      !_tui_rect_is_empty(&damage) || !tui->front_cells_valid;
+  if (tui->workers.threads_size != 0 && !tui->pipeline.is_running) {
+    if (is_drawn) {
+      _tui_render_in_bands(tui, root_widget, &damage);
+    }
+  } else {
+    if (!_tui_rect_is_empty(&damage)) {
+      _tui_clear_cells_in_rect(tui, &damage);
+      _tui_rasterize_widget(tui, root_widget, 0, 0, &damage);
+      _tui_stage_end(stats, TUI_STAGE_RASTERIZE, time);
+    }
+    if (is_drawn && tui->pipeline.is_running) {
+      _tui_publish_frame(tui);
+    } else if (is_drawn) {
+      _tui_draw_cells_to_terminal(tui, &damage);
+    }
   }
 
-  return true;
+  tui_delete_widget(old_root_widget);
+  tui->root_widget = root_widget;
+  tui->root_widget_arena = root_widget_arena;
 }
 
-const int NANO_TO_SECOND = 1000000000;
+void tui_request_redraw(TUI *tui) {
+  if (tui->wake_pipe[1] != -1) {
+    _tui_wake(tui->wake_pipe[1]);
+  }
+}
 
-int64_t nano_sleep(long int nano_seconds) {
-  struct timespec remaining,
-      request = {nano_seconds / NANO_TO_SECOND, nano_seconds % NANO_TO_SECOND};
-  nanosleep(&request, &remaining);
-  return remaining.tv_sec * NANO_TO_SECOND + remaining.tv_nsec;
+void tui_set_timer(TUI *tui, uint64_t interval) {
+  tui->timer_interval = interval;
+  tui->timer_deadline = interval == 0 ? 0 : nano_time() + interval;
+  tui_request_redraw(tui);
 }
 
-long int nano_time() {
-  struct timespec t = {0, 0}, tend = {0, 0};
-  clock_gettime(CLOCK_MONOTONIC, &t);
-  return t.tv_sec * NANO_TO_SECOND + t.tv_nsec;
+// milliseconds until the timer fires, -1 to wait forever
+int _tui_get_poll_timeout(TUI *tui) {
+  int64_t remaining = _tui_input_get_timeout(tui);
+  if (tui->timer_interval != 0) {
+    int64_t timer_remaining = tui->timer_deadline - nano_time();
+    if (timer_remaining < 0) {
+      timer_remaining = 0;
+    }
+    if (remaining == -1 || timer_remaining < remaining) {
+      remaining = timer_remaining;
+    }
+  }
+  if (remaining == -1) {
+    return -1;
+  }
+  const int64_t nano_to_milli = NANO_TO_SECOND / 1000;
+  return (remaining + nano_to_milli - 1) / nano_to_milli;
+}
+
+// Only builds a frame when something could have changed it: input, a
+// resize, the timer or tui_request_redraw. Sleeps in poll otherwise.
+void _tui_main_loop_on_demand(TUI *tui, WIDGET_BUILDER widget_builder,
+                              void *context) {
+  while (1) {
+    const long int start = nano_time();
+    _tui_render_frame(tui, widget_builder, context);
+    tui->last_frame = nano_time() - start;
+
+    while (1) {
+      struct pollfd fds[2] = {
+          {.fd = STDIN_FILENO, .events = POLLIN},
+          {.fd = tui->wake_pipe[0], .events = POLLIN},
+      };
+      const long int poll_start = nano_time();
+      const int ready = poll(fds, 2, _tui_get_poll_timeout(tui));
+      _tui_stage_end(&tui->stats, TUI_STAGE_SLEEP, poll_start);
+      if (ready < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+
+      bool should_render = false;
+      if (fds[1].revents & POLLIN) {
+        char drain[64];
+        while (read(tui->wake_pipe[0], drain, sizeof(drain)) > 0) {
+        }
+        should_render = true;
+      }
+      if (tui->timer_interval != 0 && nano_time() >= tui->timer_deadline) {
+        tui->timer_deadline += tui->timer_interval;
+        if (tui->timer_deadline < nano_time()) {
+          // don't try to catch up on missed ticks
+          tui->timer_deadline = nano_time() + tui->timer_interval;
+        }
+        should_render = true;
+      }
+      if ((fds[0].revents & POLLIN) || _tui_input_get_timeout(tui) == 0) {
+        if (handle_input(tui)) {
+          return;
+        }
+        should_render = true;
+      } else if (fds[0].revents & (POLLHUP | POLLERR)) {
+        return;
+      }
+
+      if (should_render) {
+        break;
+      }
+    }
+    _tui_stats_end_frame(&tui->stats);
+  }
 }
 
-void tui_main_loop(TUI *tui, WIDGET_BUILDER widget_builder, int fps) {
+// rate of FRAME_ON_DEMAND when nothing could wake its loop up
+const int _TUI_FALLBACK_FPS = 60;
+
+void tui_main_loop(TUI *tui, WIDGET_BUILDER widget_builder, void *context,
+                   int fps) {
+  if (fps == FRAME_ON_DEMAND && tui->wake_pipe[0] != -1) {
+    _tui_main_loop_on_demand(tui, widget_builder, context);
+    return;
+  } else if (fps == FRAME_ON_DEMAND) {
+    fps = _TUI_FALLBACK_FPS;
+  }
   const long int frame_nano =
       (fps == FRAME_UNLIMITED) ? 0 : NANO_TO_SECOND / fps;
   int64_t last_remaining = 0;
   while (1) {
     const long int start = nano_time();
-    tui_save_cursor();
-    tui_refresh(tui);
-    WIDGET *root_widget = widget_builder(tui);
-    _tui_clear_cells(tui);
-
-    int width, height;
-    _tui_draw_widget_to_cells(tui, root_widget, 0, tui_get_width(tui), 0,
-                              tui_get_height(tui), &width, &height);
-
-    _tui_draw_cells_to_terminal(tui);
-    tui_delete_widget(root_widget);
+    _tui_render_frame(tui, widget_builder, context);
     /*tui_move_to(0, 0);*/
     /*printf("%ld\t%ld", last_frame_time, frame_nano);*/
-    tui_restore_cursor();
     if (fps != FRAME_UNLIMITED) {
-      const long int diff = nano_time() - start;
+      const long int sleep_start = nano_time();
+      const long int diff = sleep_start - start;
       last_remaining = nano_sleep(frame_nano - diff + last_remaining);
+      _tui_stage_end(&tui->stats, TUI_STAGE_SLEEP, sleep_start);
     }
     tui->last_frame = nano_time() - start;
-    if (kbhit()) {
+    if (kbhit() || tui->input.size != 0) {
       if (handle_input(tui)) {
         return;
       }
     }
+    _tui_stats_end_frame(&tui->stats);
   }
 }
 
 WIDGET *tui_new_widget(WIDGET_TYPE type, void *metadata) {
-  WIDGET *widget = malloc(sizeof(WIDGET));
+  WIDGET *widget = _tui_widget_alloc(sizeof(WIDGET));
   widget->type = type;
   widget->metadata = metadata;
+  widget->layout = (WIDGET_LAYOUT){0};
+  widget->layout_frame = 0;
+  widget->equal_frame = 0;
+  widget->is_in_arena = _tui_active_arena != NULL;
+  widget->hash = _tui_hash_widget(widget);
+  ++_tui_widgets_allocated;
   return widget;
 }
 
 void tui_delete_widget(WIDGET *restrict widget) {
-  if (widget == NULL) {
+  // widgets in an arena go away all at once when their arena is reset
+  if (widget == NULL || widget->is_in_arena) {
     return;
   }
   switch (widget->type) {
@@ -586,6 +3770,12 @@ void tui_delete_widget(WIDGET *restrict widget) {
     case WIDGET_TYPE_BOX:
       _tui_delete_box(widget);
       break;
+    case WIDGET_TYPE_SCROLL_VIEW:
+      _tui_delete_scroll_view(widget);
+      break;
+    case WIDGET_TYPE_LOG_VIEW:
+      _tui_delete_log_view(widget);
+      break;
     default:
       fprintf(stderr, "Type error '%d' in tui_delete_widget\n", widget->type);
       exit(1);
@@ -594,32 +3784,83 @@ void tui_delete_widget(WIDGET *restrict widget) {
 }
 
 WIDGET *tui_make_text(char *restrict text, COLOR color) {
-  return tui_new_widget(WIDGET_TYPE_TEXT, _tui_make_text_metadata(text, color));
+  return tui_make_styled_text(text, strlen(text), color, (TUI_TEXT_STYLE){0},
+                              false);
+}
+
+WIDGET *tui_make_borrowed_text(const char *text, size_t size, COLOR color) {
+  return tui_make_styled_text(text, size, color, (TUI_TEXT_STYLE){0}, true);
+}
+
+WIDGET *tui_make_styled_text(const char *text, size_t size, COLOR color,
+                             TUI_TEXT_STYLE style, bool is_borrowed) {
+  return tui_new_widget(
+      WIDGET_TYPE_TEXT,
+      _tui_make_text_metadata(text, size, color, style, is_borrowed));
 }
 
-TEXT_METADATA *_tui_make_text_metadata(char *restrict text, COLOR color) {
-  TEXT_METADATA *metadata = malloc(sizeof(TEXT_METADATA));
-  metadata->text = malloc(strlen(text) + 1);
-  strcpy(metadata->text, text);
+WIDGET *tui_make_stats_widget(TUI *tui) {
+  char text[1024];
+  int size = snprintf(text, sizeof(text), "%-9s %8s %8s %8s (ms)\n", "stage",
+                      "p50", "p99", "max");
+  for (int i = 0; i < TUI_STAGE_COUNT; ++i) {
+    const TUI_STAT_SUMMARY summary = tui_get_stage_stats(tui, i);
+    size += snprintf(text + size, sizeof(text) - size,
+                     "%-9s %8.3f %8.3f %8.3f\n", _TUI_STAGE_NAMES[i],
+                     summary.p50 / 1e6, summary.p99 / 1e6, summary.max / 1e6);
+  }
+  for (int i = 0; i < TUI_COUNTER_COUNT; ++i) {
+    const TUI_STAT_SUMMARY summary = tui_get_counter_stats(tui, i);
+    size += snprintf(text + size, sizeof(text) - size,
+                     "%-9s %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+                     _TUI_COUNTER_NAMES[i], summary.p50, summary.p99,
+                     summary.max);
+  }
+  return tui_make_text(text, COLOR_NO_COLOR);
+}
+
+TEXT_METADATA *_tui_make_text_metadata(const char *text, size_t size,
+                                       COLOR color, TUI_TEXT_STYLE style,
+                                       bool is_borrowed) {
+  TEXT_METADATA *metadata = _tui_widget_alloc(sizeof(TEXT_METADATA));
+  if (is_borrowed) {
+    metadata->text = text;
+  } else {
+    char *copy = _tui_widget_alloc(size);
+    memcpy(copy, text, size);
+    metadata->text = copy;
+  }
+  metadata->size = size;
+  metadata->hash = _tui_hash_bytes(_TUI_HASH_SEED, text, size);
   metadata->color = color;
+  metadata->style = style;
+  metadata->is_borrowed = is_borrowed;
+  metadata->layout = NULL;
   return metadata;
 }
 
 void _tui_delete_text(WIDGET *restrict text) {
-  free(((TEXT_METADATA *)text->metadata)->text);
-  free(text->metadata);
+  TEXT_METADATA *metadata = text->metadata;
+  if (!metadata->is_borrowed) {
+    free((char *)metadata->text);
+  }
+  free(metadata->layout);
+  free(metadata);
 }
 
-WIDGET *tui_make_button(WIDGET *restrict child, ON_CLICK_CALLBACK callback) {
+WIDGET *tui_make_button(WIDGET *restrict child, ON_CLICK_CALLBACK callback,
+                        void *context) {
   return tui_new_widget(WIDGET_TYPE_BUTTON,
-                        _tui_make_button_metadata(child, callback));
+                        _tui_make_button_metadata(child, callback, context));
 }
 
 BUTTON_METADATA *_tui_make_button_metadata(WIDGET *restrict child,
-                                           ON_CLICK_CALLBACK callback) {
-  BUTTON_METADATA *metadata = malloc(sizeof(BUTTON_METADATA));
+                                           ON_CLICK_CALLBACK callback,
+                                           void *context) {
+  BUTTON_METADATA *metadata = _tui_widget_alloc(sizeof(BUTTON_METADATA));
   metadata->child = child;
   metadata->callback = callback;
+  metadata->context = context;
   return metadata;
 }
 
@@ -634,7 +3875,7 @@ WIDGET *tui_make_column(WIDGET_ARRAY *restrict children) {
 }
 
 COLUMN_METADATA *_tui_make_column_metadata(WIDGET_ARRAY *restrict children) {
-  COLUMN_METADATA *metadata = malloc(sizeof(COLUMN_METADATA));
+  COLUMN_METADATA *metadata = _tui_widget_alloc(sizeof(COLUMN_METADATA));
   metadata->children = children;
   return metadata;
 }
@@ -650,7 +3891,7 @@ WIDGET *tui_make_row(WIDGET_ARRAY *restrict children) {
 }
 
 ROW_METADATA *_tui_make_row_metadata(WIDGET_ARRAY *restrict children) {
-  ROW_METADATA *metadata = malloc(sizeof(ROW_METADATA));
+  ROW_METADATA *metadata = _tui_widget_alloc(sizeof(ROW_METADATA));
   metadata->children = children;
   return metadata;
 }
@@ -669,7 +3910,7 @@ WIDGET *tui_make_box(int width, int height, WIDGET *restrict child,
 
 BOX_METADATA *_tui_make_box_metadata(WIDGET *restrict child, int width,
                                      int height, COLOR color) {
-  BOX_METADATA *metadata = malloc(sizeof(BOX_METADATA));
+  BOX_METADATA *metadata = _tui_widget_alloc(sizeof(BOX_METADATA));
   metadata->width = width;
   metadata->height = height;
   metadata->child = child;
@@ -682,21 +3923,158 @@ void _tui_delete_box(WIDGET *box) {
   free(box->metadata);
 }
 
+WIDGET *tui_make_scroll_view(size_t item_count, ITEM_BUILDER item_builder,
+                             void *context, TUI_SCROLL_STATE *state) {
+  if (state->offset >= item_count) {
+    state->offset = item_count == 0 ? 0 : item_count - 1;
+  }
+  state->item_count = item_count;
+  return tui_new_widget(
+      WIDGET_TYPE_SCROLL_VIEW,
+      _tui_make_scroll_view_metadata(tui_new_widget_array(0), state,
+                                     state->offset, item_count, item_builder,
+                                     context));
+}
+
+SCROLL_VIEW_METADATA *_tui_make_scroll_view_metadata(
+    WIDGET_ARRAY *restrict children, TUI_SCROLL_STATE *state, size_t offset,
+    size_t item_count, ITEM_BUILDER item_builder, void *context) {
+  SCROLL_VIEW_METADATA *metadata =
+      _tui_widget_alloc(sizeof(SCROLL_VIEW_METADATA));
+  metadata->children = children;
+  metadata->capacity = children->size;
+  metadata->state = state;
+  metadata->offset = offset;
+  metadata->item_count = item_count;
+  metadata->item_builder = item_builder;
+  metadata->context = context;
+  return metadata;
+}
+
+// Builds the next item of a scroll view into its children. The children grow
+// where the view lives, in its frame arena or on the heap for a promoted one.
+WIDGET *_tui_scroll_view_build_item(WIDGET *scroll_view) {
+  SCROLL_VIEW_METADATA *metadata = scroll_view->metadata;
+  WIDGET_ARRAY *children = metadata->children;
+  TUI_ARENA *const previous_arena = _tui_active_arena;
+  if (!scroll_view->is_in_arena) {
+    _tui_active_arena = NULL;
+  }
+  if (children->size == metadata->capacity) {
+    metadata->capacity = metadata->capacity == 0 ? 16 : 2 * metadata->capacity;
+    WIDGET **widgets =
+        _tui_widget_alloc(metadata->capacity * sizeof(WIDGET *));
+    memcpy(widgets, children->widgets, children->size * sizeof(WIDGET *));
+    if (!scroll_view->is_in_arena) {
+      free(children->widgets);
+    }
+    children->widgets = widgets;
+  }
+  WIDGET *item = metadata->item_builder(metadata->offset + children->size,
+                                        metadata->context);
+  children->widgets[children->size++] = item;
+  _tui_active_arena = previous_arena;
+  return item;
+}
+
+void _tui_delete_scroll_view(WIDGET *restrict scroll_view) {
+  SCROLL_VIEW_METADATA *metadata = scroll_view->metadata;
+  _tui_delete_widget_array(metadata->children);
+  free(scroll_view->metadata);
+}
+
+void _tui_scroll_view_on_mouse(const MOUSE_ACTION *mouse_action,
+                               void *context) {
+  const size_t _TUI_SCROLL_STEP = 3;
+  TUI_SCROLL_STATE *state = context;
+  const size_t step = _TUI_SCROLL_STEP * mouse_action->count;
+  if (mouse_action->button == MOUSE_BUTTON_SCROLL_UP) {
+    state->offset = state->offset > step ? state->offset - step : 0;
+  } else if (mouse_action->button == MOUSE_BUTTON_SCROLL_DOWN) {
+    // stop when the last item is at the bottom of the view
+    const size_t last_offset = state->item_count > state->page_size
+                                   ? state->item_count - state->page_size
+                                   : 0;
+    if (state->offset < last_offset) {
+      state->offset = last_offset - state->offset > step
+                          ? state->offset + step
+                          : last_offset;
+    }
+  }
+}
+
+WIDGET *tui_make_log_view(TUI_LOG *log, COLOR color) {
+  pthread_mutex_lock(&log->mutex);
+  const size_t end_line = log->first_line + log->lines_size;
+  size_t last_size = 0;
+  _tui_log_line(log, end_line - 1, &last_size);
+  pthread_mutex_unlock(&log->mutex);
+  return tui_new_widget(
+      WIDGET_TYPE_LOG_VIEW,
+      _tui_make_log_view_metadata(log, end_line, last_size, color));
+}
+
+LOG_VIEW_METADATA *_tui_make_log_view_metadata(TUI_LOG *log, size_t end_line,
+                                               size_t last_size, COLOR color) {
+  LOG_VIEW_METADATA *metadata = _tui_widget_alloc(sizeof(LOG_VIEW_METADATA));
+  metadata->log = log;
+  metadata->end_line = end_line;
+  metadata->last_size = last_size;
+  metadata->first_line = end_line;
+  metadata->color = color;
+  return metadata;
+}
+
+void _tui_delete_log_view(WIDGET *restrict log_view) {
+  free(log_view->metadata);
+}
+
+// Line index of the log as it was when the view was made, false if it is not
+// kept anymore. The log must be locked.
+bool _tui_log_view_line(const LOG_VIEW_METADATA *metadata, size_t index,
+                        TEXT_METADATA *text) {
+  if (index >= metadata->end_line) {
+    return false;
+  }
+  size_t size;
+  const char *line = _tui_log_line(metadata->log, index, &size);
+  if (line == NULL) {
+    return false;
+  }
+  // the newest line may have grown since
+  if (index + 1 == metadata->end_line) {
+    size = metadata->last_size;
+  }
+  *text = (TEXT_METADATA){
+      .text = line,
+      .size = size,
+      .hash = 0,  // not hashed as it is not a widget
+      .color = metadata->color,
+      .style = {0},
+      .is_borrowed = true,
+      .layout = NULL,
+  };
+  return true;
+}
+
 WIDGET_ARRAY *tui_make_widget_array_raw(size_t size, ...) {
   va_list arg_pointer;
   va_start(arg_pointer, size);
 
-  WIDGET **widgets = malloc(size * sizeof(WIDGET **));
+  WIDGET_ARRAY *widget_array = tui_new_widget_array(size);
 
   for (size_t i = 0; i < size; ++i) {
-    widgets[i] = va_arg(arg_pointer, WIDGET *);
+    widget_array->widgets[i] = va_arg(arg_pointer, WIDGET *);
   }
   va_end(arg_pointer);
 
-  WIDGET_ARRAY *widget_array = malloc(sizeof(WIDGET_ARRAY));
-  widget_array->widgets = widgets;
-  widget_array->size = size;
+  return widget_array;
+}
 
+WIDGET_ARRAY *tui_new_widget_array(size_t size) {
+  WIDGET_ARRAY *widget_array = _tui_widget_alloc(sizeof(WIDGET_ARRAY));
+  widget_array->widgets = _tui_widget_alloc(size * sizeof(WIDGET *));
+  widget_array->size = size;
   return widget_array;
 }
 
@@ -707,3 +4085,85 @@ void _tui_delete_widget_array(WIDGET_ARRAY *restrict widget_array) {
   free(widget_array->widgets);
   free(widget_array);
 }
+
+WIDGET_ARRAY *_tui_promote_widget_array(const WIDGET_ARRAY *widget_array) {
+  WIDGET **widgets = malloc(widget_array->size * sizeof(WIDGET *));
+  for (size_t i = 0; i < widget_array->size; ++i) {
+    widgets[i] = tui_promote_widget(widget_array->widgets[i]);
+  }
+
+  WIDGET_ARRAY *promoted = malloc(sizeof(WIDGET_ARRAY));
+  promoted->widgets = widgets;
+  promoted->size = widget_array->size;
+  return promoted;
+}
+
+WIDGET *tui_promote_widget(const WIDGET *widget) {
+  if (widget == NULL) {
+    return NULL;
+  }
+
+  TUI_ARENA *const previous_arena = _tui_active_arena;
+  _tui_active_arena = NULL;
+
+  WIDGET *promoted;
+  switch (widget->type) {
+    case WIDGET_TYPE_TEXT: {
+      const TEXT_METADATA *metadata = widget->metadata;
+      // borrowed text may not live as long as the copy
+      promoted = tui_new_widget(
+          WIDGET_TYPE_TEXT,
+          _tui_make_text_metadata(metadata->text, metadata->size,
+                                  metadata->color, metadata->style, false));
+      if (metadata->layout != NULL) {
+        _tui_set_text_layout(promoted,
+                             _tui_copy_text_layout(promoted, metadata->layout));
+      }
+    } break;
+    case WIDGET_TYPE_BUTTON: {
+      const BUTTON_METADATA *metadata = widget->metadata;
+      promoted = tui_make_button(tui_promote_widget(metadata->child),
+                                 metadata->callback, metadata->context);
+    } break;
+    case WIDGET_TYPE_COLUMN: {
+      const COLUMN_METADATA *metadata = widget->metadata;
+      promoted =
+          tui_make_column(_tui_promote_widget_array(metadata->children));
+    } break;
+    case WIDGET_TYPE_ROW: {
+      const ROW_METADATA *metadata = widget->metadata;
+      promoted = tui_make_row(_tui_promote_widget_array(metadata->children));
+    } break;
+    case WIDGET_TYPE_BOX: {
+      const BOX_METADATA *metadata = widget->metadata;
+      promoted = tui_make_box(metadata->width, metadata->height,
+                              tui_promote_widget(metadata->child),
+                              metadata->color);
+    } break;
+    case WIDGET_TYPE_SCROLL_VIEW: {
+      const SCROLL_VIEW_METADATA *metadata = widget->metadata;
+      promoted = tui_new_widget(
+          WIDGET_TYPE_SCROLL_VIEW,
+          _tui_make_scroll_view_metadata(
+              _tui_promote_widget_array(metadata->children), metadata->state,
+              metadata->offset, metadata->item_count, metadata->item_builder,
+              metadata->context));
+    } break;
+    case WIDGET_TYPE_LOG_VIEW: {
+      const LOG_VIEW_METADATA *metadata = widget->metadata;
+      LOG_VIEW_METADATA *promoted_metadata =
+          _tui_make_log_view_metadata(metadata->log, metadata->end_line,
+                                      metadata->last_size, metadata->color);
+      // goes along with the layout
+      promoted_metadata->first_line = metadata->first_line;
+      promoted = tui_new_widget(WIDGET_TYPE_LOG_VIEW, promoted_metadata);
+    } break;
+    default:
+      fprintf(stderr, "Type error '%d' in tui_promote_widget\n", widget->type);
+      exit(1);
+  }
+  promoted->layout = widget->layout;
+
+  _tui_active_arena = previous_arena;
+  return promoted;
+}
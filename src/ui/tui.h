@@ -1,6 +1,10 @@
 #ifndef A404M_UI_TUI
 #define A404M_UI_TUI 1
 
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -13,22 +17,36 @@ extern const int MIN_WIDTH;
 extern const int MIN_HEIGHT;
 
 extern const int FRAME_UNLIMITED;
+// Only draw on input, resize, the timer or tui_request_redraw. Falls back to
+// a fixed rate if the TUI could not make its wake pipe.
+extern const int FRAME_ON_DEMAND;
 
 typedef enum MOUSE_BUTTON {
   MOUSE_BUTTON_LEFT_CLICK = 32,
   MOUSE_BUTTON_MIDDLE_CLICK = 33,
   MOUSE_BUTTON_RIGHT_CLICK = 34,
+  MOUSE_BUTTON_MOVE = 67,
   MOUSE_BUTTON_SCROLL_UP = 96,
   MOUSE_BUTTON_SCROLL_DOWN = 97,
 } MOUSE_BUTTON;
 
+// keys held during a mouse event, as the terminal reports them
+typedef enum MOUSE_MODIFIER {
+  MOUSE_MODIFIER_SHIFT = 4,
+  MOUSE_MODIFIER_META = 8,
+  MOUSE_MODIFIER_CONTROL = 16,
+} MOUSE_MODIFIER;
+
 typedef struct MOUSE_ACTION {
   MOUSE_BUTTON button;
+  unsigned int modifiers;  // of MOUSE_MODIFIER
   unsigned int x;
   unsigned int y;
+  unsigned int count;  // how many events were merged into this one
 } MOUSE_ACTION;
 
-typedef void (*ON_CLICK_CALLBACK)(const MOUSE_ACTION *mouse_action);
+typedef void (*ON_CLICK_CALLBACK)(const MOUSE_ACTION *mouse_action,
+                                  void *context);
 
 #ifndef __cplusplus
   #if (__STDC_VERSION__ < 202000L)
@@ -36,6 +54,8 @@ typedef enum bool : uint8_t { false = 0, true = 1 } bool;
   #endif
 #endif
 
+// The eight ANSI colors, or a color of tui_color_indexed or tui_color_rgb
+// tagged with COLOR_INDEXED or COLOR_RGB
 typedef enum COLOR {
   COLOR_NO_COLOR = -1,
   COLOR_RESET = 0,
@@ -45,22 +65,303 @@ typedef enum COLOR {
   COLOR_BLUE = 4,
   COLOR_MAGENTA = 5,
   COLOR_CYAN = 6,
-  COLOR_WHITE = 7
+  COLOR_WHITE = 7,
+  COLOR_INDEXED = 1 << 24,  // one of the 256 colors in the low byte
+  COLOR_RGB = 1 << 25,      // 0xRRGGBB in the low 3 bytes
 } COLOR;
 
+// set in TERMINAL_CELL.text for the index of a cluster of the TUI
+#define TUI_CELL_CLUSTER (1u << 31)
+
+// one 64 bit word, so rows can be cleared and compared a cell at a time
 typedef struct TERMINAL_CELL {
-  char c;
-  COLOR color;
-  COLOR background_color;
-  ON_CLICK_CALLBACK on_click_callback;
+  // The codepoint of the character, or TUI_CELL_CLUSTER and the index of a
+  // character with marks combined with it. 0 in the cell after a wide
+  // character.
+  uint32_t text;
+  uint16_t color;             // of the palette of the TUI
+  uint16_t background_color;  // of the palette of the TUI
 } TERMINAL_CELL;
 
+_Static_assert(sizeof(TERMINAL_CELL) == sizeof(uint64_t),
+               "TERMINAL_CELL must stay packed into a word");
+
+// UTF-8 of a character and the marks combined with it, padded with zeros
+typedef struct TUI_CLUSTER {
+  char text[8];
+} TUI_CLUSTER;
+
+// Characters with combining marks, which take more than the codepoint of a
+// cell. They are added under the mutex by the threads that draw and never
+// change after, so the encoders read them without it.
+typedef struct TUI_CLUSTERS {
+  pthread_mutex_t mutex;
+  TUI_CLUSTER *clusters;  // allocated when the first one is added
+  size_t size;
+  int *table;  // index + 1 of the clusters by hash, 0 for free slots
+} TUI_CLUSTERS;
+
+// Colors cells are drawn with, by their index. The ANSI colors and the 256
+// colors have fixed indices, RGB colors are added when they are first drawn.
+// Entries are never removed or changed, so the threads that draw and encode
+// share them without locks.
+typedef struct TUI_PALETTE {
+  atomic_uint *rgb_colors;  // 0xRRGGBB with bit 24 set, 0 for free slots
+} TUI_PALETTE;
+
+typedef struct TUI_BUFFER {
+  char *data;
+  size_t size;
+  size_t capacity;
+} TUI_BUFFER;
+
+// Hashes of the rows of the frame being encoded and of the front cells, to
+// find rows that only moved up or down. Rows of different bands use disjoint
+// parts of them.
+typedef struct TUI_ROW_HASHES {
+  uint64_t *rows;
+  uint64_t *front_rows;
+  int *table;  // front rows by hash, two slots per row
+  int capacity;
+} TUI_ROW_HASHES;
+
+// Colors the terminal draws with while rows are encoded, the default colors are
+// COLOR_RESET and COLOR_NO_COLOR is not known yet
+typedef struct TUI_SGR_STATE {
+  int32_t color;             // COLOR
+  int32_t background_color;  // COLOR
+} TUI_SGR_STATE;
+
+// A parameter of SGR that sets a color, like "38;5;208"
+typedef struct TUI_SGR_PARAMETER {
+  char text[8];
+  uint8_t size;
+} TUI_SGR_PARAMETER;
+
+// What the terminal supports beyond moving the cursor and colors
+typedef enum TUI_TERMINAL_FEATURE {
+  TUI_FEATURE_REP = 1 << 0,  // CSI b repeats the last character
+  TUI_FEATURE_BCE = 1 << 1,  // erased cells take the background color
+  TUI_FEATURE_256_COLORS = 1 << 2,  // the xterm palette of 256 colors
+  TUI_FEATURE_TRUECOLOR = 1 << 3,  // colors are drawn as they are in RGB
+} TUI_TERMINAL_FEATURE;
+
+typedef enum TUI_SINK_TYPE {
+  TUI_SINK_FD,      // written to fd once per frame
+  TUI_SINK_MEMORY,  // kept until tui_take_sink_data
+} TUI_SINK_TYPE;
+
+// Where escape sequences and frames go. What is emitted between frames is
+// buffered and goes out along with the next frame.
+typedef struct TUI_SINK {
+  TUI_SINK_TYPE type;
+  int fd;  // for TUI_SINK_FD
+  TUI_BUFFER pending;
+  pthread_mutex_t mutex;  // the output thread writes through it too
+} TUI_SINK;
+
+typedef struct TUI_RECT {
+  int width_begin;
+  int width_end;  // exclusive
+  int height_begin;
+  int height_end;  // exclusive
+} TUI_RECT;
+
+typedef struct TUI_HIT_TARGET {
+  TUI_RECT rect;
+  ON_CLICK_CALLBACK callback;
+  void *context;
+} TUI_HIT_TARGET;
+
+// part of a row that clicks go to a single target
+typedef struct TUI_HIT_SPAN {
+  int width_begin;
+  int width_end;  // exclusive
+  size_t target;
+} TUI_HIT_SPAN;
+
+// Clickable rectangles of the last frame. The later registered target wins
+// where they overlap. Rows are split into sorted spans on the first query
+// after a change, so a click is a binary search within its row.
+typedef struct TUI_HIT_INDEX {
+  TUI_HIT_TARGET *targets;
+  size_t targets_size;
+  size_t targets_capacity;
+  bool is_built;
+  int height;          // rows of row_begins
+  size_t *row_begins;  // spans of row y are [row_begins[y], row_begins[y+1])
+  size_t rows_capacity;
+  TUI_HIT_SPAN *spans;
+  size_t spans_size;
+  size_t spans_capacity;
+  TUI_HIT_SPAN *scratch;  // targets of a row before overlaps are resolved
+  size_t scratch_capacity;
+} TUI_HIT_INDEX;
+
+typedef struct WIDGET WIDGET;
+
+typedef struct TUI_ARENA_BLOCK TUI_ARENA_BLOCK;
+
+// bump allocator that is reset as a whole instead of freeing each allocation
+typedef struct TUI_ARENA {
+  TUI_ARENA_BLOCK *first;
+  TUI_ARENA_BLOCK *current;
+} TUI_ARENA;
+
+typedef enum TUI_EVENT_TYPE {
+  TUI_EVENT_NONE,
+  TUI_EVENT_KEY,
+  TUI_EVENT_MOUSE,
+  TUI_EVENT_CURSOR_POSITION,
+} TUI_EVENT_TYPE;
+
+typedef struct TUI_EVENT {
+  TUI_EVENT_TYPE type;
+  unsigned char key;
+  MOUSE_ACTION mouse;
+} TUI_EVENT;
+
+typedef struct TUI_INPUT {
+  unsigned char data[4096];  // ring buffer of not yet decoded input
+  size_t head;
+  size_t size;
+  int64_t pending_since;  // when the buffer began to end in a partial escape
+  bool is_waiting_cursor_position;
+} TUI_INPUT;
+
+typedef enum TUI_STAGE {
+  TUI_STAGE_INPUT,
+  TUI_STAGE_BUILD,
+  TUI_STAGE_LAYOUT,
+  TUI_STAGE_RASTERIZE,
+  TUI_STAGE_ENCODE,
+  TUI_STAGE_WRITE,
+  TUI_STAGE_SLEEP,
+  TUI_STAGE_COUNT,
+} TUI_STAGE;
+
+typedef enum TUI_COUNTER {
+  TUI_COUNTER_BYTES_WRITTEN,
+  TUI_COUNTER_CELLS_CHANGED,
+  TUI_COUNTER_WIDGETS_ALLOCATED,
+  TUI_COUNTER_COUNT,
+} TUI_COUNTER;
+
+#define TUI_STAT_WINDOW 256
+
+// per frame values of the last TUI_STAT_WINDOW frames
+typedef struct TUI_STAT {
+  _Atomic uint64_t pending;  // of the frame in progress, from any thread
+  uint64_t samples[TUI_STAT_WINDOW];
+  size_t head;
+  size_t size;
+  uint64_t total;  // of every frame so far
+} TUI_STAT;
+
+typedef struct TUI_STAT_SUMMARY {
+  uint64_t last;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t max;
+  uint64_t total;
+} TUI_STAT_SUMMARY;
+
+typedef struct TUI_STATS {
+  uint64_t frames;
+  TUI_STAT stages[TUI_STAGE_COUNT];  // in nanoseconds
+  TUI_STAT counters[TUI_COUNTER_COUNT];
+} TUI_STATS;
+
+// rows of the screen rendered and encoded by one thread
+typedef struct TUI_BAND {
+  int height_begin;
+  int height_end;  // exclusive
+  TUI_BUFFER output;
+} TUI_BAND;
+
+typedef struct TUI_WORKERS {
+  pthread_t *threads;
+  int threads_size;
+  pthread_mutex_t mutex;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t generation;  // incremented for every frame handed out
+  bool is_stopping;
+  TUI_BAND *bands;  // one more than threads, the caller renders one too
+  int bands_size;
+  int next_band;
+  int bands_done;
+  const WIDGET *root_widget;  // of the frame being rendered
+  TUI_RECT damage;
+} TUI_WORKERS;
+
+// cells of a finished frame on their way to the output thread
+typedef struct TUI_FRAME {
+  TERMINAL_CELL *cells;
+  size_t cells_capacity;
+  int width;
+  int height;
+  bool is_repaint;  // the terminal must be drawn again as a whole
+  unsigned int terminal_features;
+} TUI_FRAME;
+
+// Hands frames from the building thread to the output thread through a
+// triple buffer. Each side owns one frame and swaps it with the middle one
+// without locks, so a slow write never blocks building the next frame and
+// the output thread always picks up the latest frame.
+typedef struct TUI_PIPELINE {
+  bool is_running;
+  pthread_t thread;
+  TUI_FRAME frames[3];
+  atomic_uint middle;  // index of the middle frame, with _TUI_FRAME_FRESH
+                       // set while the output thread has not taken it
+  unsigned int back;   // owned by the building thread
+  unsigned int front;  // owned by the output thread
+  sem_t wake;
+  atomic_bool is_stopping;
+  // the output thread's copy of what is on the terminal
+  TERMINAL_CELL *front_cells;
+  size_t front_cells_capacity;
+  int front_width;
+  int front_height;
+  TUI_ROW_HASHES row_hashes;
+  TUI_BUFFER output;
+  TUI_SINK *sink;
+  TUI_STATS *stats;
+  const TUI_PALETTE *palette;
+  const TUI_CLUSTERS *clusters;
+} TUI_PIPELINE;
+
 typedef struct TUI {
   struct winsize size;
   struct termios original, raw, helper;
   int init_cursor_x, init_cursor_y;
-  TERMINAL_CELL *cells;
+  TERMINAL_CELL *cells;        // frame being drawn
+  TERMINAL_CELL *front_cells;  // what is currently on the terminal
+  bool front_cells_valid;
+  TUI_PALETTE palette;
+  TUI_CLUSTERS clusters;
   size_t cells_length;
+  size_t cells_capacity;
+  TUI_ROW_HASHES row_hashes;
+  TUI_BUFFER output;    // reused across frames
+  TUI_SINK sink;
+  unsigned int terminal_features;  // of TUI_TERMINAL_FEATURE
+  TUI_RECT exposed;     // area uncovered by a resize since the last frame
+  TUI_HIT_INDEX hit_index;
+  TUI_HIT_INDEX scroll_index;  // scroll views, wheel events go there first
+  TUI_WORKERS workers;
+  TUI_PIPELINE pipeline;
+  TUI_STATS stats;
+  WIDGET *root_widget;  // what the last frame was drawn from
+  bool use_frame_arena;
+  TUI_ARENA frame_arenas[2];  // one may hold root_widget, the other is free
+  TUI_ARENA *root_widget_arena;
+  TUI_INPUT input;
+  int wake_pipe[2];  // -1 if it could not be made
+  struct TUI *_Atomic next_live;  // in the list of TUIs SIGWINCH wakes
+  int64_t timer_interval;  // in nanoseconds, 0 for no timer
+  int64_t timer_deadline;
   uint64_t last_frame;  // in nanoseconds
 } TUI;
 
@@ -70,26 +371,75 @@ typedef enum WIDGET_TYPE {
   WIDGET_TYPE_COLUMN,
   WIDGET_TYPE_ROW,
   WIDGET_TYPE_BOX,
+  WIDGET_TYPE_SCROLL_VIEW,
+  WIDGET_TYPE_LOG_VIEW,
 } WIDGET_TYPE;
 
-typedef struct WIDGET {
+// Memoized measurement of a widget. Sizes are relative to the widget's own
+// origin and the position is relative to its parent's origin.
+typedef struct WIDGET_LAYOUT {
+  bool is_valid;
+  int available_width;  // the constraint the measurement is valid for
+  int available_height;
+  int width;
+  int height;
+  int x;
+  int y;
+} WIDGET_LAYOUT;
+
+struct WIDGET {
   WIDGET_TYPE type;
   void *metadata;
-} WIDGET;
+  uint64_t hash;  // structural hash of the widget and its children
+  WIDGET_LAYOUT layout;
+  // A promoted widget that is reused is in the last frame's tree too, which
+  // damage is found against. old_layout keeps what it had there once the
+  // frame numbered layout_frame lays it out again.
+  WIDGET_LAYOUT old_layout;
+  uint64_t layout_frame;
+  // the frame numbered equal_frame found it equal to its twin in the last
+  // frame's tree, which finding damage skips it for
+  uint64_t equal_frame;
+  bool is_in_arena;
+};
 
 typedef struct WIDGET_ARRAY {
   size_t size;
   WIDGET **widgets;
 } WIDGET_ARRAY;
 
+typedef enum TUI_TEXT_WRAP {
+  TUI_TEXT_WRAP_CHAR,  // at the last character that fits, like the terminal
+  TUI_TEXT_WRAP_WORD,  // at spaces, a word longer than a line like CHAR
+  TUI_TEXT_WRAP_NONE,  // lines are cut at the last character that fits
+} TUI_TEXT_WRAP;
+
+// How text is laid out, zeroed is the default
+typedef struct TUI_TEXT_STYLE {
+  TUI_TEXT_WRAP wrap;
+  int tab_width;      // columns between tab stops, 0 for 8
+  bool has_ellipsis;  // text cut by the width or height ends with "…"
+} TUI_TEXT_STYLE;
+
+typedef struct TUI_TEXT_LAYOUT TUI_TEXT_LAYOUT;
+
 typedef struct TEXT_METADATA {
-  char *text;
+  const char *text;  // not NUL terminated
+  size_t size;
+  uint64_t hash;  // of the bytes
   COLOR color;
+  TUI_TEXT_STYLE style;
+  bool is_borrowed;  // owned by the caller, not freed with the widget
+  // Lines at the width the widget was last laid out at, NULL before. It is
+  // allocated along with the widget and handed on to its equal in the next
+  // frame, so text that stays the same is only broken into lines once.
+  TUI_TEXT_LAYOUT *layout;
 } TEXT_METADATA;
 
 typedef struct BUTTON_METADATA {
   WIDGET *child;
   ON_CLICK_CALLBACK callback;
+  void *context;  // passed to callback
 } BUTTON_METADATA;
 
 typedef struct COLUMN_METADATA {
@@ -107,7 +457,59 @@ typedef struct BOX_METADATA {
   COLOR color;
 } BOX_METADATA;
 
-typedef WIDGET *(*WIDGET_BUILDER)(TUI *tui);
+// Where a scroll view is scrolled to. It is kept by the caller across frames
+// and starts zeroed, offset may be set to scroll programmatically.
+typedef struct TUI_SCROLL_STATE {
+  size_t offset;      // index of the first visible item
+  size_t item_count;  // of the last scroll view made with it
+  size_t page_size;   // items that fit in the view when it was last laid out
+} TUI_SCROLL_STATE;
+
+// Builds the item at index of a scroll view
+typedef WIDGET *(*ITEM_BUILDER)(size_t index, void *context);
+
+typedef struct SCROLL_VIEW_METADATA {
+  // the items from offset that may be visible, built when it is measured
+  WIDGET_ARRAY *children;
+  size_t capacity;  // of children->widgets
+  TUI_SCROLL_STATE *state;
+  size_t offset;
+  size_t item_count;
+  ITEM_BUILDER item_builder;
+  void *context;
+} SCROLL_VIEW_METADATA;
+
+// a line of a TUI_LOG, begin is counted in bytes ever appended
+typedef struct TUI_LOG_LINE {
+  size_t begin;
+  size_t size;
+} TUI_LOG_LINE;
+
+// Lines of text kept in a fixed amount of memory, the oldest ones are dropped
+// to make room for new ones. Every line is kept in one piece in buffer, so it
+// can be drawn from there without copying.
+typedef struct TUI_LOG {
+  char *buffer;
+  size_t capacity;
+  size_t end;           // bytes ever appended, where the next line begins
+  TUI_LOG_LINE *lines;  // ring, line i is at lines[i % lines_capacity]
+  size_t lines_capacity;
+  size_t first_line;  // index of the oldest line kept
+  size_t lines_size;
+  bool is_line_open;  // the newest line has no '\n' yet
+  pthread_mutex_t mutex;
+} TUI_LOG;
+
+typedef struct LOG_VIEW_METADATA {
+  TUI_LOG *log;
+  size_t end_line;    // one past the newest line when the view was made
+  size_t last_size;   // of the newest line when the view was made
+  size_t first_line;  // oldest line that fits, set by the layout
+  COLOR color;
+} LOG_VIEW_METADATA;
+
+// Builds the widgets of a frame, context is what the app passed along with it
+typedef WIDGET *(*WIDGET_BUILDER)(TUI *tui, void *context);
 
 extern TUI *tui_init();
 extern void tui_delete(TUI *restrict tui);
@@ -117,12 +519,39 @@ extern int tui_get_width(TUI *tui);
 extern int tui_get_height(TUI *tui);
 
 extern void tui_get_cursor_pos(TUI *tui, int *x, int *y);
-extern int tui_move_to(int x, int y);
-
-extern int tui_clear_screen();
-
-extern void tui_start_app(TUI *tui, WIDGET_BUILDER widget_builder, int fps);
-extern void _tui_draw_widget_to_cells(TUI *tui, const WIDGET *widget,
+extern int tui_move_to(TUI *tui, int x, int y);
+
+extern int tui_clear_screen(TUI *tui);
+
+// Sends the output to fd, such as a socket or a pseudo terminal, instead of
+// stdout. The terminal modes are reset on the old sink and set up on the new
+// one, and the next frame is drawn as a whole.
+extern void tui_use_fd_sink(TUI *tui, int fd);
+// Keeps the output in memory instead, to be read with tui_take_sink_data
+extern void tui_use_memory_sink(TUI *tui);
+// Hands over what a memory sink captured so far, the result must be freed
+extern char *tui_take_sink_data(TUI *tui, size_t *size);
+// Writes what was emitted since the last frame without waiting for the next
+extern void tui_flush(TUI *tui);
+
+// Features are guessed from TERM by tui_init, this overrides them with a mask
+// of TUI_TERMINAL_FEATURE
+extern void tui_set_terminal_features(TUI *tui, unsigned int features);
+
+// Colors beyond the ANSI ones. They are drawn with the nearest color the
+// terminal has when it lacks TUI_FEATURE_256_COLORS or TUI_FEATURE_TRUECOLOR.
+extern COLOR tui_color_indexed(uint8_t index);
+extern COLOR tui_color_rgb(uint8_t red, uint8_t green, uint8_t blue);
+// Fills the tables colors are encoded and quantized with
+extern void _tui_build_color_tables();
+// The palette index of color, COLOR_NO_COLOR included. Safe to call from the
+// threads that draw.
+extern uint16_t _tui_color_index(TUI_PALETTE *palette, COLOR color);
+extern COLOR _tui_palette_color(const TUI_PALETTE *palette, uint16_t index);
+
+extern void tui_start_app(TUI *tui, WIDGET_BUILDER widget_builder,
+                          void *context, int fps);
+extern void _tui_draw_widget_to_cells(TUI *tui, WIDGET *widget,
                                       int width_begin, int width_end,
                                       int height_begin, int height_end,
                                       int *child_width, int *childHeight);
@@ -131,20 +560,86 @@ extern bool tui_widget_eqauls(const WIDGET *restrict left,
                               const WIDGET *restrict right);
 extern bool tui_widget_array_eqauls(const WIDGET_ARRAY *restrict left,
                                     const WIDGET_ARRAY *restrict right);
-
-extern void tui_main_loop(TUI *tui, WIDGET_BUILDER widget_builder, int fps);
+extern uint64_t _tui_hash_combine(uint64_t hash, uint64_t value);
+
+extern void tui_main_loop(TUI *tui, WIDGET_BUILDER widget_builder,
+                          void *context, int fps);
+
+// Builds and draws one frame, what tui_main_loop does between waits
+extern void _tui_render_frame(TUI *tui, WIDGET_BUILDER widget_builder,
+                              void *context);
+// Reads and dispatches the pending input, returns true if the app should quit
+extern bool handle_input(TUI *tui);
+extern void _tui_stats_end_frame(TUI_STATS *stats);
+
+// Makes the main loop build a new frame as soon as possible. Safe to call
+// from other threads and signal handlers.
+extern void tui_request_redraw(TUI *tui);
+
+// Builds a frame every interval nanoseconds with FRAME_ON_DEMAND, 0 disables
+extern void tui_set_timer(TUI *tui, uint64_t interval);
+
+// When enabled, every widget made by the WIDGET_BUILDER is allocated from a
+// frame arena which is reset in O(1) instead of freeing the tree node by node.
+// Such widgets are only valid until the frame after next is built, use
+// tui_promote_widget to keep a copy of them.
+extern void tui_use_frame_arena(TUI *tui, bool use_frame_arena);
+
+// Renders and encodes frames in horizontal bands on count worker threads
+// along with the calling thread. 0 renders on the calling thread only.
+extern void tui_use_workers(TUI *tui, int count);
+extern void _tui_stop_workers(TUI *tui);
+extern void _tui_delete_row_hashes(TUI_ROW_HASHES *hashes);
+
+// Encodes and writes frames on a dedicated output thread while the calling
+// thread goes on to handle input and build the next frame. Frames the
+// terminal can't keep up with are skipped. Rasterization then stays on the
+// calling thread even with workers.
+extern void tui_use_output_thread(TUI *tui, bool use_output_thread);
+extern void _tui_stop_output_thread(TUI *tui);
+
+// Time spent in a stage or the value of a counter over the last frames. In
+// pipeline mode encode and write are counted to the frame being built when
+// the output thread finishes them.
+extern TUI_STAT_SUMMARY tui_get_stage_stats(TUI *tui, TUI_STAGE stage);
+extern TUI_STAT_SUMMARY tui_get_counter_stats(TUI *tui, TUI_COUNTER counter);
+
+// A text widget showing the stats, to put in the frame being built
+extern WIDGET *tui_make_stats_widget(TUI *tui);
+
+// Writes the stats to path as tab separated values, returns false on failure
+extern bool tui_dump_stats(TUI *tui, const char *path);
+
+// Deep copies widget to the heap, the result must be freed with
+// tui_delete_widget
+extern WIDGET *tui_promote_widget(const WIDGET *widget);
 
 extern WIDGET *tui_new_widget(WIDGET_TYPE type, void *metadata);
 extern void tui_delete_widget(WIDGET *restrict widget);
 
 extern WIDGET *tui_make_text(char *restrict text, COLOR color);
-extern TEXT_METADATA *_tui_make_text_metadata(char *restrict text, COLOR color);
+// A text widget showing size bytes of text without copying them. The text
+// must stay valid and unchanged as long as the widget is, which is until the
+// frame after next is built for widgets of a frame arena.
+extern WIDGET *tui_make_borrowed_text(const char *text, size_t size,
+                                      COLOR color);
+#define tui_make_literal_text(literal, color) \
+  tui_make_borrowed_text(literal, sizeof(literal) - 1, color)
+// A text widget laid out with style, borrowing text like
+// tui_make_borrowed_text if is_borrowed
+extern WIDGET *tui_make_styled_text(const char *text, size_t size, COLOR color,
+                                    TUI_TEXT_STYLE style, bool is_borrowed);
+extern TEXT_METADATA *_tui_make_text_metadata(const char *text, size_t size,
+                                              COLOR color,
+                                              TUI_TEXT_STYLE style,
+                                              bool is_borrowed);
 extern void _tui_delete_text(WIDGET *restrict text);
 
 extern WIDGET *tui_make_button(WIDGET *restrict child,
-                               ON_CLICK_CALLBACK callback);
+                               ON_CLICK_CALLBACK callback, void *context);
 extern BUTTON_METADATA *_tui_make_button_metadata(WIDGET *restrict child,
-                                                  ON_CLICK_CALLBACK callback);
+                                                  ON_CLICK_CALLBACK callback,
+                                                  void *context);
 extern void _tui_delete_button(WIDGET *restrict button);
 
 extern WIDGET *tui_make_column(WIDGET_ARRAY *restrict children);
@@ -162,7 +657,46 @@ extern BOX_METADATA *_tui_make_box_metadata(WIDGET *restrict child, int width,
                                             int height, COLOR color);
 extern void _tui_delete_box(WIDGET *restrict box);
 
+// A column of item_count items that shows as many of them from
+// state->offset as fit and scrolls with the mouse wheel. Items are built when
+// the view is laid out and only until they fill it, so a frame costs the same
+// for any number of items. Items that take no rows don't count towards
+// filling it. context is passed to item_builder.
+extern WIDGET *tui_make_scroll_view(size_t item_count,
+                                    ITEM_BUILDER item_builder, void *context,
+                                    TUI_SCROLL_STATE *state);
+extern SCROLL_VIEW_METADATA *_tui_make_scroll_view_metadata(
+    WIDGET_ARRAY *restrict children, TUI_SCROLL_STATE *state, size_t offset,
+    size_t item_count, ITEM_BUILDER item_builder, void *context);
+extern void _tui_delete_scroll_view(WIDGET *restrict scroll_view);
+extern WIDGET *_tui_scroll_view_build_item(WIDGET *scroll_view);
+extern void _tui_scroll_view_on_mouse(const MOUSE_ACTION *mouse_action,
+                                      void *context);
+
+// Keeps the newest lines of up to capacity bytes and lines_capacity lines,
+// a line longer than capacity is cut
+extern TUI_LOG *tui_new_log(size_t capacity, size_t lines_capacity);
+extern void tui_delete_log(TUI_LOG *log);
+// Adds text to the end of the log, only the new bytes are scanned for lines.
+// Safe to call from other threads, call tui_request_redraw to show it.
+extern void tui_log_append(TUI_LOG *log, const char *text, size_t size);
+// Bytes of the line at index, NULL if it is not kept. The log must be locked.
+extern const char *_tui_log_line(const TUI_LOG *log, size_t index,
+                                 size_t *size);
+
+// The newest lines of log that fit, drawn straight from its buffer
+extern WIDGET *tui_make_log_view(TUI_LOG *log, COLOR color);
+extern LOG_VIEW_METADATA *_tui_make_log_view_metadata(TUI_LOG *log,
+                                                      size_t end_line,
+                                                      size_t last_size,
+                                                      COLOR color);
+extern void _tui_delete_log_view(WIDGET *restrict log_view);
+extern bool _tui_log_view_line(const LOG_VIEW_METADATA *metadata,
+                               size_t index, TEXT_METADATA *text);
+
 extern WIDGET_ARRAY *tui_make_widget_array_raw(size_t size, ...);
+// An array of size widgets that are to be set by the caller
+extern WIDGET_ARRAY *tui_new_widget_array(size_t size);
 extern void _tui_delete_widget_array(WIDGET_ARRAY *restrict widget_array);
 
 #define tui_make_widget_array(...) \
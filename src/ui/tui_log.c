@@ -0,0 +1,99 @@
+#include "tui.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+TUI_LOG *tui_new_log(size_t capacity, size_t lines_capacity) {
+  if (capacity == 0 || lines_capacity == 0) {
+    fprintf(stderr, "a log needs room for at least one byte and line\n");
+    exit(1);
+  }
+  TUI_LOG *log = malloc(sizeof(TUI_LOG));
+  log->buffer = malloc(capacity);
+  log->capacity = capacity;
+  log->end = 0;
+  log->lines = malloc(lines_capacity * sizeof(TUI_LOG_LINE));
+  log->lines_capacity = lines_capacity;
+  log->first_line = 0;
+  log->lines_size = 0;
+  log->is_line_open = false;
+  pthread_mutex_init(&log->mutex, NULL);
+  return log;
+}
+
+void tui_delete_log(TUI_LOG *log) {
+  pthread_mutex_destroy(&log->mutex);
+  free(log->lines);
+  free(log->buffer);
+  free(log);
+}
+
+TUI_LOG_LINE *_tui_log_newest_line(TUI_LOG *log) {
+  return &log->lines[(log->first_line + log->lines_size - 1) %
+                     log->lines_capacity];
+}
+
+// Adds size bytes to the newest line, or to a new one if it is closed. Old
+// lines are dropped until the bytes from the oldest line kept to the end fit
+// in the buffer, so the ones kept are never overwritten.
+void _tui_log_extend(TUI_LOG *log, const char *text, size_t size) {
+  if (!log->is_line_open) {
+    if (log->lines_size == log->lines_capacity) {
+      ++log->first_line;
+      --log->lines_size;
+    }
+    ++log->lines_size;
+    *_tui_log_newest_line(log) = (TUI_LOG_LINE){.begin = log->end, .size = 0};
+    log->is_line_open = true;
+  }
+
+  TUI_LOG_LINE *line = _tui_log_newest_line(log);
+  if (size > log->capacity - line->size) {
+    size = log->capacity - line->size;
+  }
+  const size_t offset = line->begin % log->capacity;
+  // a line that would wrap around the buffer moves to its start instead
+  const bool is_moved = offset + line->size + size > log->capacity;
+  const size_t begin =
+      is_moved ? line->begin - offset + log->capacity : line->begin;
+  log->end = begin + line->size + size;
+
+  while (log->lines_size > 1 &&
+         log->end - log->lines[log->first_line % log->lines_capacity].begin >
+             log->capacity) {
+    ++log->first_line;
+    --log->lines_size;
+  }
+
+  if (is_moved) {
+    memmove(log->buffer, log->buffer + offset, line->size);
+    line->begin = begin;
+  }
+  memcpy(log->buffer + begin % log->capacity + line->size, text, size);
+  line->size += size;
+}
+
+void tui_log_append(TUI_LOG *log, const char *text, size_t size) {
+  pthread_mutex_lock(&log->mutex);
+  const char *const end = text + size;
+  while (text < end) {
+    const char *newline = memchr(text, '\n', end - text);
+    _tui_log_extend(log, text, (newline == NULL ? end : newline) - text);
+    if (newline == NULL) {
+      break;
+    }
+    log->is_line_open = false;
+    text = newline + 1;
+  }
+  pthread_mutex_unlock(&log->mutex);
+}
+
+const char *_tui_log_line(const TUI_LOG *log, size_t index, size_t *size) {
+  if (index < log->first_line || index - log->first_line >= log->lines_size) {
+    return NULL;
+  }
+  const TUI_LOG_LINE *line = &log->lines[index % log->lines_capacity];
+  *size = line->size;
+  return log->buffer + line->begin % log->capacity;
+}
@@ -0,0 +1,379 @@
+#include "tui_simd.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TUI_SIMD_X86 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define TUI_SIMD_NEON 1
+#endif
+
+uint64_t _tui_cell_bits(const TERMINAL_CELL *cell) {
+  uint64_t bits;
+  memcpy(&bits, cell, sizeof(bits));
+  return bits;
+}
+
+void _tui_fill_scalar(TERMINAL_CELL *cells, TERMINAL_CELL cell, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    cells[i] = cell;
+  }
+}
+
+size_t _tui_first_difference_scalar(const TERMINAL_CELL *left,
+                                    const TERMINAL_CELL *right, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    if (_tui_cell_bits(left + i) != _tui_cell_bits(right + i)) {
+      return i;
+    }
+  }
+  return size;
+}
+
+size_t _tui_last_difference_scalar(const TERMINAL_CELL *left,
+                                   const TERMINAL_CELL *right, size_t size) {
+  for (size_t i = size; i != 0; --i) {
+    if (_tui_cell_bits(left + i - 1) != _tui_cell_bits(right + i - 1)) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+size_t _tui_first_equal_scalar(const TERMINAL_CELL *left,
+                               const TERMINAL_CELL *right, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    if (_tui_cell_bits(left + i) == _tui_cell_bits(right + i)) {
+      return i;
+    }
+  }
+  return size;
+}
+
+size_t _tui_run_length_scalar(const TERMINAL_CELL *cells, uint64_t mask,
+                              size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  const uint64_t first = _tui_cell_bits(cells) & mask;
+  size_t i = 1;
+  while (i < size && (_tui_cell_bits(cells + i) & mask) == first) {
+    ++i;
+  }
+  return i;
+}
+
+const TUI_CELL_KERNELS _tui_cell_kernels_scalar = {
+    .name = "scalar",
+    .fill = _tui_fill_scalar,
+    .first_difference = _tui_first_difference_scalar,
+    .last_difference = _tui_last_difference_scalar,
+    .first_equal = _tui_first_equal_scalar,
+    .run_length = _tui_run_length_scalar,
+};
+
+#ifdef TUI_SIMD_X86
+
+// SSE2 has no 64 bit compare, the halves of each cell are compared as 32 bit
+// words and a cell is equal when both of them are
+__attribute__((target("sse2"))) __m128i _tui_sse2_cmpeq(__m128i left,
+                                                        __m128i right) {
+  const __m128i equal = _mm_cmpeq_epi32(left, right);
+  return _mm_and_si128(equal,
+                       _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+// one bit per cell of a 4 cell compare
+__attribute__((target("sse2"))) int _tui_sse2_mask(__m128i equal_0,
+                                                   __m128i equal_1) {
+  return _mm_movemask_pd(_mm_castsi128_pd(equal_0)) |
+         _mm_movemask_pd(_mm_castsi128_pd(equal_1)) << 2;
+}
+
+__attribute__((target("sse2"))) __m128i _tui_sse2_load(
+    const TERMINAL_CELL *cells) {
+  return _mm_loadu_si128((const __m128i *)cells);
+}
+
+__attribute__((target("sse2"))) int _tui_sse2_compare(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right) {
+  return _tui_sse2_mask(
+      _tui_sse2_cmpeq(_tui_sse2_load(left), _tui_sse2_load(right)),
+      _tui_sse2_cmpeq(_tui_sse2_load(left + 2), _tui_sse2_load(right + 2)));
+}
+
+__attribute__((target("sse2"))) void _tui_fill_sse2(TERMINAL_CELL *cells,
+                                                    TERMINAL_CELL cell,
+                                                    size_t size) {
+  const __m128i value = _mm_set1_epi64x(_tui_cell_bits(&cell));
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    _mm_storeu_si128((__m128i *)(cells + i), value);
+  }
+  _tui_fill_scalar(cells + i, cell, size - i);
+}
+
+__attribute__((target("sse2"))) size_t _tui_first_difference_sse2(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right, size_t size) {
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const int mask = _tui_sse2_compare(left + i, right + i);
+    if (mask != 0xF) {
+      return i + __builtin_ctz(~mask);
+    }
+  }
+  return i + _tui_first_difference_scalar(left + i, right + i, size - i);
+}
+
+__attribute__((target("sse2"))) size_t _tui_last_difference_sse2(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right, size_t size) {
+  size_t i = size;
+  for (; i >= 4; i -= 4) {
+    const int mask = _tui_sse2_compare(left + i - 4, right + i - 4);
+    if (mask != 0xF) {
+      return i - 4 + (32 - __builtin_clz(~mask & 0xF));
+    }
+  }
+  return _tui_last_difference_scalar(left, right, i);
+}
+
+__attribute__((target("sse2"))) size_t _tui_first_equal_sse2(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right, size_t size) {
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const int mask = _tui_sse2_compare(left + i, right + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + _tui_first_equal_scalar(left + i, right + i, size - i);
+}
+
+__attribute__((target("sse2"))) size_t _tui_run_length_sse2(
+    const TERMINAL_CELL *cells, uint64_t mask, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  const __m128i bits = _mm_set1_epi64x(mask);
+  const __m128i first = _mm_set1_epi64x(_tui_cell_bits(cells) & mask);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const int equal = _tui_sse2_mask(
+        _tui_sse2_cmpeq(_mm_and_si128(_tui_sse2_load(cells + i), bits), first),
+        _tui_sse2_cmpeq(_mm_and_si128(_tui_sse2_load(cells + i + 2), bits),
+                        first));
+    if (equal != 0xF) {
+      return i + __builtin_ctz(~equal);
+    }
+  }
+  for (; i < size; ++i) {
+    if ((_tui_cell_bits(cells + i) & mask) != (_tui_cell_bits(cells) & mask)) {
+      return i;
+    }
+  }
+  return size;
+}
+
+const TUI_CELL_KERNELS _tui_cell_kernels_sse2 = {
+    .name = "sse2",
+    .fill = _tui_fill_sse2,
+    .first_difference = _tui_first_difference_sse2,
+    .last_difference = _tui_last_difference_sse2,
+    .first_equal = _tui_first_equal_sse2,
+    .run_length = _tui_run_length_sse2,
+};
+
+__attribute__((target("avx2"))) __m256i _tui_avx2_load(
+    const TERMINAL_CELL *cells) {
+  return _mm256_loadu_si256((const __m256i *)cells);
+}
+
+// one bit per cell of an 8 cell compare
+__attribute__((target("avx2"))) int _tui_avx2_mask(__m256i equal_0,
+                                                   __m256i equal_1) {
+  return _mm256_movemask_pd(_mm256_castsi256_pd(equal_0)) |
+         _mm256_movemask_pd(_mm256_castsi256_pd(equal_1)) << 4;
+}
+
+__attribute__((target("avx2"))) int _tui_avx2_compare(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right) {
+  return _tui_avx2_mask(
+      _mm256_cmpeq_epi64(_tui_avx2_load(left), _tui_avx2_load(right)),
+      _mm256_cmpeq_epi64(_tui_avx2_load(left + 4), _tui_avx2_load(right + 4)));
+}
+
+__attribute__((target("avx2"))) void _tui_fill_avx2(TERMINAL_CELL *cells,
+                                                    TERMINAL_CELL cell,
+                                                    size_t size) {
+  const __m256i value = _mm256_set1_epi64x(_tui_cell_bits(&cell));
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm256_storeu_si256((__m256i *)(cells + i), value);
+  }
+  _tui_fill_scalar(cells + i, cell, size - i);
+}
+
+__attribute__((target("avx2"))) size_t _tui_first_difference_avx2(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const int mask = _tui_avx2_compare(left + i, right + i);
+    if (mask != 0xFF) {
+      return i + __builtin_ctz(~mask);
+    }
+  }
+  return i + _tui_first_difference_sse2(left + i, right + i, size - i);
+}
+
+__attribute__((target("avx2"))) size_t _tui_last_difference_avx2(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right, size_t size) {
+  size_t i = size;
+  for (; i >= 8; i -= 8) {
+    const int mask = _tui_avx2_compare(left + i - 8, right + i - 8);
+    if (mask != 0xFF) {
+      return i - 8 + (32 - __builtin_clz(~mask & 0xFF));
+    }
+  }
+  return _tui_last_difference_sse2(left, right, i);
+}
+
+__attribute__((target("avx2"))) size_t _tui_first_equal_avx2(
+    const TERMINAL_CELL *left, const TERMINAL_CELL *right, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const int mask = _tui_avx2_compare(left + i, right + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + _tui_first_equal_sse2(left + i, right + i, size - i);
+}
+
+__attribute__((target("avx2"))) size_t _tui_run_length_avx2(
+    const TERMINAL_CELL *cells, uint64_t mask, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  const __m256i bits = _mm256_set1_epi64x(mask);
+  const __m256i first = _mm256_set1_epi64x(_tui_cell_bits(cells) & mask);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const int equal = _tui_avx2_mask(
+        _mm256_cmpeq_epi64(_mm256_and_si256(_tui_avx2_load(cells + i), bits),
+                           first),
+        _mm256_cmpeq_epi64(
+            _mm256_and_si256(_tui_avx2_load(cells + i + 4), bits), first));
+    if (equal != 0xFF) {
+      return i + __builtin_ctz(~equal);
+    }
+  }
+  for (; i < size; ++i) {
+    if ((_tui_cell_bits(cells + i) & mask) != (_tui_cell_bits(cells) & mask)) {
+      return i;
+    }
+  }
+  return size;
+}
+
+const TUI_CELL_KERNELS _tui_cell_kernels_avx2 = {
+    .name = "avx2",
+    .fill = _tui_fill_avx2,
+    .first_difference = _tui_first_difference_avx2,
+    .last_difference = _tui_last_difference_avx2,
+    .first_equal = _tui_first_equal_avx2,
+    .run_length = _tui_run_length_avx2,
+};
+
+#endif
+
+#ifdef TUI_SIMD_NEON
+
+uint64x2_t _tui_neon_load(const TERMINAL_CELL *cells) {
+  return vld1q_u64((const uint64_t *)cells);
+}
+
+// all bits set in the lanes where all 4 cells are equal
+uint64x2_t _tui_neon_compare(const TERMINAL_CELL *left,
+                             const TERMINAL_CELL *right) {
+  return vandq_u64(
+      vceqq_u64(_tui_neon_load(left), _tui_neon_load(right)),
+      vceqq_u64(_tui_neon_load(left + 2), _tui_neon_load(right + 2)));
+}
+
+bool _tui_neon_is_all_set(uint64x2_t equal) {
+  return vminvq_u32(vreinterpretq_u32_u64(equal)) != 0;
+}
+
+void _tui_fill_neon(TERMINAL_CELL *cells, TERMINAL_CELL cell, size_t size) {
+  const uint64x2_t value = vdupq_n_u64(_tui_cell_bits(&cell));
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    vst1q_u64((uint64_t *)(cells + i), value);
+  }
+  _tui_fill_scalar(cells + i, cell, size - i);
+}
+
+// NEON has no movemask, so a block that is not all alike is searched with
+// the scalar kernels
+
+size_t _tui_first_difference_neon(const TERMINAL_CELL *left,
+                                  const TERMINAL_CELL *right, size_t size) {
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    if (!_tui_neon_is_all_set(_tui_neon_compare(left + i, right + i))) {
+      return i + _tui_first_difference_scalar(left + i, right + i, 4);
+    }
+  }
+  return i + _tui_first_difference_scalar(left + i, right + i, size - i);
+}
+
+size_t _tui_last_difference_neon(const TERMINAL_CELL *left,
+                                 const TERMINAL_CELL *right, size_t size) {
+  size_t i = size;
+  for (; i >= 4; i -= 4) {
+    if (!_tui_neon_is_all_set(_tui_neon_compare(left + i - 4, right + i - 4))) {
+      return i - 4 +
+             _tui_last_difference_scalar(left + i - 4, right + i - 4, 4);
+    }
+  }
+  return _tui_last_difference_scalar(left, right, i);
+}
+
+const TUI_CELL_KERNELS _tui_cell_kernels_neon = {
+    .name = "neon",
+    .fill = _tui_fill_neon,
+    .first_difference = _tui_first_difference_neon,
+    .last_difference = _tui_last_difference_neon,
+    .first_equal = _tui_first_equal_scalar,
+    .run_length = _tui_run_length_scalar,
+};
+
+#endif
+
+TUI_CELL_KERNELS _tui_cell_kernels = {
+    .name = "scalar",
+    .fill = _tui_fill_scalar,
+    .first_difference = _tui_first_difference_scalar,
+    .last_difference = _tui_last_difference_scalar,
+    .first_equal = _tui_first_equal_scalar,
+    .run_length = _tui_run_length_scalar,
+};
+
+void _tui_select_cell_kernels() {
+#if defined(TUI_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    _tui_cell_kernels = _tui_cell_kernels_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    _tui_cell_kernels = _tui_cell_kernels_sse2;
+  } else {
+    _tui_cell_kernels = _tui_cell_kernels_scalar;
+  }
+#elif defined(TUI_SIMD_NEON)
+  _tui_cell_kernels = _tui_cell_kernels_neon;
+#else
+  _tui_cell_kernels = _tui_cell_kernels_scalar;
+#endif
+}
@@ -0,0 +1,37 @@
+#ifndef A404M_UI_TUI_SIMD
+#define A404M_UI_TUI_SIMD 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tui.h"
+
+// Inner loops over rows of cells. Every cell is compared as one 64 bit word,
+// the implementation is picked at runtime for the running CPU.
+typedef struct TUI_CELL_KERNELS {
+  const char *name;
+  void (*fill)(TERMINAL_CELL *cells, TERMINAL_CELL cell, size_t size);
+  // index of the first cell that differs, size if none
+  size_t (*first_difference)(const TERMINAL_CELL *left,
+                             const TERMINAL_CELL *right, size_t size);
+  // one past the last cell that differs, 0 if none
+  size_t (*last_difference)(const TERMINAL_CELL *left,
+                            const TERMINAL_CELL *right, size_t size);
+  // index of the first cell that is equal, size if none
+  size_t (*first_equal)(const TERMINAL_CELL *left, const TERMINAL_CELL *right,
+                        size_t size);
+  // number of leading cells equal to the first one in the bits of mask
+  size_t (*run_length)(const TERMINAL_CELL *cells, uint64_t mask, size_t size);
+} TUI_CELL_KERNELS;
+
+extern TUI_CELL_KERNELS _tui_cell_kernels;
+
+extern const TUI_CELL_KERNELS _tui_cell_kernels_scalar;
+
+// Sets _tui_cell_kernels to the fastest kernels the CPU supports
+extern void _tui_select_cell_kernels();
+
+// the cell as the word it is compared by
+extern uint64_t _tui_cell_bits(const TERMINAL_CELL *cell);
+
+#endif
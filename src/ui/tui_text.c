@@ -0,0 +1,166 @@
+#include "tui_text.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tui_width.h"
+
+const int _TUI_DEFAULT_TAB_WIDTH = 8;
+
+int _tui_tab_width(const TUI_TEXT_STYLE *style) {
+  return style->tab_width > 0 ? style->tab_width : _TUI_DEFAULT_TAB_WIDTH;
+}
+
+bool _tui_is_space(char c) { return c == ' ' || c == '\t'; }
+
+void _tui_read_char(const char *text, size_t size, int column,
+                    int tab_width, TUI_TEXT_CHAR *character) {
+  if (*text == '\t') {
+    *character = (TUI_TEXT_CHAR){
+        .codepoint = '\t',
+        .size = 1,
+        .columns = tab_width - column % tab_width,
+    };
+    return;
+  }
+  character->size = _tui_decode_utf8(text, size, &character->codepoint);
+  const TUI_WIDTH columns = _tui_char_width(character->codepoint);
+  if (columns == TUI_WIDTH_INVALID) {
+    character->codepoint = 0xFFFD;
+    character->columns = 1;
+  } else {
+    character->columns = columns;
+  }
+}
+
+// columns the bytes [begin, end) of a line take, all of which fit in width
+int _tui_text_columns(const char *text, size_t begin, size_t end, int width,
+                      int tab_width) {
+  int column = 0;
+  while (begin < end) {
+    const size_t run = _tui_printable_run(text + begin, end - begin);
+    if (run != 0) {
+      column += run;
+      begin += run;
+      continue;
+    }
+    TUI_TEXT_CHAR character;
+    _tui_read_char(text + begin, end - begin, column, tab_width, &character);
+    begin += character.size;
+    if (character.columns <= width) {
+      column += character.columns;
+    }
+  }
+  return column;
+}
+
+void _tui_push_text_line(TUI_TEXT_LAYOUT *layout, TUI_TEXT_LINE line) {
+  if (layout->lines_size == layout->lines_capacity) {
+    layout->lines_capacity =
+        layout->lines_capacity == 0 ? 16 : layout->lines_capacity * 2;
+    layout->lines = realloc(layout->lines,
+                            layout->lines_capacity * sizeof(TUI_TEXT_LINE));
+  }
+  layout->lines[layout->lines_size++] = line;
+}
+
+// Breaks the bytes [begin, end) of text, which have no '\n', into lines
+void _tui_layout_paragraph(TUI_TEXT_LAYOUT *layout, const char *text,
+                           size_t begin, size_t end, int width,
+                           TUI_TEXT_WRAP wrap, int tab_width) {
+  size_t i = begin;
+  do {
+    int column = 0;
+    size_t j = i;
+    while (j < end) {
+      // printable ASCII takes a column per byte, so as much of it as fits is
+      // taken at once
+      const size_t run = _tui_printable_run(text + j, end - j);
+      if (run != 0) {
+        const size_t columns_left = width - column;
+        const size_t size = run < columns_left ? run : columns_left;
+        column += size;
+        j += size;
+        if (size < run) {
+          break;
+        }
+        continue;
+      }
+      TUI_TEXT_CHAR character;
+      _tui_read_char(text + j, end - j, column, tab_width, &character);
+      if (character.codepoint == '\t') {
+        if (column == width) {
+          break;
+        } else if (column + character.columns > width) {
+          character.columns = width - column;  // stops at the end of the line
+        }
+      }
+      if (character.columns > width) {
+        j += character.size;  // never fits
+        continue;
+      } else if (column + character.columns > width) {
+        break;
+      }
+      column += character.columns;
+      j += character.size;
+    }
+
+    TUI_TEXT_LINE line = {
+        .begin = i, .end = j, .width = column, .is_cut = false};
+    size_t next = j;
+    if (j < end) {
+      if (wrap == TUI_TEXT_WRAP_NONE) {
+        line.is_cut = true;
+        next = end;
+      } else if (wrap == TUI_TEXT_WRAP_WORD) {
+        // the line ends before the last spaces in it or right after it, and
+        // the next one starts after them
+        size_t space = j;
+        while (space > i && !_tui_is_space(text[space])) {
+          --space;
+        }
+        while (space > i && _tui_is_space(text[space - 1])) {
+          --space;
+        }
+        if (space > i) {
+          line.end = space;
+          line.width = _tui_text_columns(text, i, space, width, tab_width);
+          next = space;
+          while (next < end && _tui_is_space(text[next])) {
+            ++next;
+          }
+        }
+      }
+    }
+    _tui_push_text_line(layout, line);
+    i = next;
+  } while (i < end);
+}
+
+void _tui_layout_text(TUI_TEXT_LAYOUT *layout, const TEXT_METADATA *text,
+                      int width) {
+  layout->width = width;
+  layout->lines_size = 0;
+  if (width <= 0) {
+    return;
+  }
+
+  const int tab_width = _tui_tab_width(&text->style);
+  size_t begin = 0;
+  while (true) {
+    const char *newline = memchr(text->text + begin, '\n', text->size - begin);
+    const size_t end =
+        newline == NULL ? text->size : (size_t)(newline - text->text);
+    _tui_layout_paragraph(layout, text->text, begin, end, width,
+                          text->style.wrap, tab_width);
+    if (newline == NULL) {
+      break;
+    }
+    begin = end + 1;
+  }
+}
+
+void _tui_delete_text_layout(TUI_TEXT_LAYOUT *layout) {
+  free(layout->lines);
+  *layout = (TUI_TEXT_LAYOUT){0};
+}
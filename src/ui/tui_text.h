@@ -0,0 +1,47 @@
+#ifndef A404M_UI_TUI_TEXT
+#define A404M_UI_TUI_TEXT 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tui.h"
+
+// A line text takes on the screen, made of the bytes [begin, end) of it
+typedef struct TUI_TEXT_LINE {
+  size_t begin;
+  size_t end;
+  int width;    // in columns
+  bool is_cut;  // the rest of the line up to its '\n' didn't fit
+} TUI_TEXT_LINE;
+
+// The lines text breaks into at width columns
+struct TUI_TEXT_LAYOUT {
+  int width;
+  TUI_TEXT_LINE *lines;
+  size_t lines_size;
+  size_t lines_capacity;
+};
+
+// A character as it is drawn
+typedef struct TUI_TEXT_CHAR {
+  uint32_t codepoint;  // '\t' for a tab, which is drawn as spaces
+  size_t size;         // bytes of the text it is made of
+  int columns;
+} TUI_TEXT_CHAR;
+
+// columns between the tab stops of style
+extern int _tui_tab_width(const TUI_TEXT_STYLE *style);
+
+// Reads the character at the start of text that is drawn at column. Control
+// characters other than tab and bytes that are not UTF-8 become U+FFFD.
+extern void _tui_read_char(const char *text, size_t size, int column,
+                           int tab_width, TUI_TEXT_CHAR *character);
+
+// Breaks text into the lines it takes at width columns, reusing the memory
+// of the lines layout had
+extern void _tui_layout_text(TUI_TEXT_LAYOUT *layout, const TEXT_METADATA *text,
+                             int width);
+
+extern void _tui_delete_text_layout(TUI_TEXT_LAYOUT *layout);
+
+#endif
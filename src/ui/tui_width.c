@@ -0,0 +1,326 @@
+#include "tui_width.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct TUI_CODEPOINT_RANGE {
+  uint32_t first;
+  uint32_t last;
+} TUI_CODEPOINT_RANGE;
+
+// East Asian wide and fullwidth codepoints, from Unicode 14
+const TUI_CODEPOINT_RANGE _tui_wide_ranges[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x3029},
+    {0x302E, 0x303E}, {0x3041, 0x3096}, {0x309B, 0x3247}, {0x3250, 0x4DBF},
+    {0x4E00, 0xA4C6}, {0xA960, 0xA97C}, {0xAC00, 0xD7A3}, {0xF900, 0xFAD9},
+    {0xFE10, 0xFE19}, {0xFE30, 0xFE6B}, {0xFF01, 0xFF60}, {0xFFE0, 0xFFE6},
+    {0x16FE0, 0x16FE3}, {0x16FF0, 0x1B2FB}, {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A},
+    {0x1F200, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C},
+    {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3},
+    {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E},
+    {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D},
+    {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A},
+    {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F},
+    {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2},
+    {0x1F6D5, 0x1F6DF}, {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC},
+    {0x1F7E0, 0x1F7F0}, {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945},
+    {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAF6}, {0x20000, 0x3FFFD},};
+
+// combining marks, zero width spaces and joiners and Hangul medial vowels
+// and final consonants, from Unicode 14
+const TUI_CODEPOINT_RANGE _tui_zero_width_ranges[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+    {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711}, {0x0730, 0x074A},
+    {0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x07FD, 0x07FD}, {0x0816, 0x0819},
+    {0x081B, 0x0823}, {0x0825, 0x0827}, {0x0829, 0x082D}, {0x0859, 0x085B},
+    {0x0898, 0x089F}, {0x08CA, 0x08E1}, {0x08E3, 0x0902}, {0x093A, 0x093A},
+    {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957},
+    {0x0962, 0x0963}, {0x0981, 0x0981}, {0x09BC, 0x09BC}, {0x09C1, 0x09C4},
+    {0x09CD, 0x09CD}, {0x09E2, 0x09E3}, {0x09FE, 0x0A02}, {0x0A3C, 0x0A3C},
+    {0x0A41, 0x0A51}, {0x0A70, 0x0A71}, {0x0A75, 0x0A75}, {0x0A81, 0x0A82},
+    {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC8}, {0x0ACD, 0x0ACD}, {0x0AE2, 0x0AE3},
+    {0x0AFA, 0x0B01}, {0x0B3C, 0x0B3C}, {0x0B3F, 0x0B3F}, {0x0B41, 0x0B44},
+    {0x0B4D, 0x0B56}, {0x0B62, 0x0B63}, {0x0B82, 0x0B82}, {0x0BC0, 0x0BC0},
+    {0x0BCD, 0x0BCD}, {0x0C00, 0x0C00}, {0x0C04, 0x0C04}, {0x0C3C, 0x0C3C},
+    {0x0C3E, 0x0C40}, {0x0C46, 0x0C56}, {0x0C62, 0x0C63}, {0x0C81, 0x0C81},
+    {0x0CBC, 0x0CBC}, {0x0CBF, 0x0CBF}, {0x0CC6, 0x0CC6}, {0x0CCC, 0x0CCD},
+    {0x0CE2, 0x0CE3}, {0x0D00, 0x0D01}, {0x0D3B, 0x0D3C}, {0x0D41, 0x0D44},
+    {0x0D4D, 0x0D4D}, {0x0D62, 0x0D63}, {0x0D81, 0x0D81}, {0x0DCA, 0x0DCA},
+    {0x0DD2, 0x0DD6}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+    {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD}, {0x0F18, 0x0F19},
+    {0x0F35, 0x0F35}, {0x0F37, 0x0F37}, {0x0F39, 0x0F39}, {0x0F71, 0x0F7E},
+    {0x0F80, 0x0F84}, {0x0F86, 0x0F87}, {0x0F8D, 0x0FBC}, {0x0FC6, 0x0FC6},
+    {0x102D, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103A}, {0x103D, 0x103E},
+    {0x1058, 0x1059}, {0x105E, 0x1060}, {0x1071, 0x1074}, {0x1082, 0x1082},
+    {0x1085, 0x1086}, {0x108D, 0x108D}, {0x109D, 0x109D}, {0x1160, 0x11FF},
+    {0x135D, 0x135F}, {0x1712, 0x1714}, {0x1732, 0x1733}, {0x1752, 0x1753},
+    {0x1772, 0x1773}, {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17C6},
+    {0x17C9, 0x17D3}, {0x17DD, 0x17DD}, {0x180B, 0x180D}, {0x180F, 0x180F},
+    {0x1885, 0x1886}, {0x18A9, 0x18A9}, {0x1920, 0x1922}, {0x1927, 0x1928},
+    {0x1932, 0x1932}, {0x1939, 0x193B}, {0x1A17, 0x1A18}, {0x1A1B, 0x1A1B},
+    {0x1A56, 0x1A56}, {0x1A58, 0x1A60}, {0x1A62, 0x1A62}, {0x1A65, 0x1A6C},
+    {0x1A73, 0x1A7F}, {0x1AB0, 0x1B03}, {0x1B34, 0x1B34}, {0x1B36, 0x1B3A},
+    {0x1B3C, 0x1B3C}, {0x1B42, 0x1B42}, {0x1B6B, 0x1B73}, {0x1B80, 0x1B81},
+    {0x1BA2, 0x1BA5}, {0x1BA8, 0x1BA9}, {0x1BAB, 0x1BAD}, {0x1BE6, 0x1BE6},
+    {0x1BE8, 0x1BE9}, {0x1BED, 0x1BED}, {0x1BEF, 0x1BF1}, {0x1C2C, 0x1C33},
+    {0x1C36, 0x1C37}, {0x1CD0, 0x1CD2}, {0x1CD4, 0x1CE0}, {0x1CE2, 0x1CE8},
+    {0x1CED, 0x1CED}, {0x1CF4, 0x1CF4}, {0x1CF8, 0x1CF9}, {0x1DC0, 0x1DFF},
+    {0x200B, 0x200D}, {0x2060, 0x2060}, {0x20D0, 0x20F0}, {0x2CEF, 0x2CF1},
+    {0x2D7F, 0x2D7F}, {0x2DE0, 0x2DFF}, {0x302A, 0x302D}, {0x3099, 0x309A},
+    {0xA66F, 0xA672}, {0xA674, 0xA67D}, {0xA69E, 0xA69F}, {0xA6F0, 0xA6F1},
+    {0xA802, 0xA802}, {0xA806, 0xA806}, {0xA80B, 0xA80B}, {0xA825, 0xA826},
+    {0xA82C, 0xA82C}, {0xA8C4, 0xA8C5}, {0xA8E0, 0xA8F1}, {0xA8FF, 0xA8FF},
+    {0xA926, 0xA92D}, {0xA947, 0xA951}, {0xA980, 0xA982}, {0xA9B3, 0xA9B3},
+    {0xA9B6, 0xA9B9}, {0xA9BC, 0xA9BD}, {0xA9E5, 0xA9E5}, {0xAA29, 0xAA2E},
+    {0xAA31, 0xAA32}, {0xAA35, 0xAA36}, {0xAA43, 0xAA43}, {0xAA4C, 0xAA4C},
+    {0xAA7C, 0xAA7C}, {0xAAB0, 0xAAB0}, {0xAAB2, 0xAAB4}, {0xAAB7, 0xAAB8},
+    {0xAABE, 0xAABF}, {0xAAC1, 0xAAC1}, {0xAAEC, 0xAAED}, {0xAAF6, 0xAAF6},
+    {0xABE5, 0xABE5}, {0xABE8, 0xABE8}, {0xABED, 0xABED}, {0xFB1E, 0xFB1E},
+    {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x101FD, 0x101FD},
+    {0x102E0, 0x102E0}, {0x10376, 0x1037A}, {0x10A01, 0x10A0F},
+    {0x10A38, 0x10A3F}, {0x10AE5, 0x10AE6}, {0x10D24, 0x10D27},
+    {0x10EAB, 0x10EAC}, {0x10F46, 0x10F50}, {0x10F82, 0x10F85},
+    {0x11001, 0x11001}, {0x11038, 0x11046}, {0x11070, 0x11070},
+    {0x11073, 0x11074}, {0x1107F, 0x11081}, {0x110B3, 0x110B6},
+    {0x110B9, 0x110BA}, {0x110C2, 0x110C2}, {0x11100, 0x11102},
+    {0x11127, 0x1112B}, {0x1112D, 0x11134}, {0x11173, 0x11173},
+    {0x11180, 0x11181}, {0x111B6, 0x111BE}, {0x111C9, 0x111CC},
+    {0x111CF, 0x111CF}, {0x1122F, 0x11231}, {0x11234, 0x11234},
+    {0x11236, 0x11237}, {0x1123E, 0x1123E}, {0x112DF, 0x112DF},
+    {0x112E3, 0x112EA}, {0x11300, 0x11301}, {0x1133B, 0x1133C},
+    {0x11340, 0x11340}, {0x11366, 0x11374}, {0x11438, 0x1143F},
+    {0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145E, 0x1145E},
+    {0x114B3, 0x114B8}, {0x114BA, 0x114BA}, {0x114BF, 0x114C0},
+    {0x114C2, 0x114C3}, {0x115B2, 0x115B5}, {0x115BC, 0x115BD},
+    {0x115BF, 0x115C0}, {0x115DC, 0x115DD}, {0x11633, 0x1163A},
+    {0x1163D, 0x1163D}, {0x1163F, 0x11640}, {0x116AB, 0x116AB},
+    {0x116AD, 0x116AD}, {0x116B0, 0x116B5}, {0x116B7, 0x116B7},
+    {0x1171D, 0x1171F}, {0x11722, 0x11725}, {0x11727, 0x1172B},
+    {0x1182F, 0x11837}, {0x11839, 0x1183A}, {0x1193B, 0x1193C},
+    {0x1193E, 0x1193E}, {0x11943, 0x11943}, {0x119D4, 0x119DB},
+    {0x119E0, 0x119E0}, {0x11A01, 0x11A0A}, {0x11A33, 0x11A38},
+    {0x11A3B, 0x11A3E}, {0x11A47, 0x11A47}, {0x11A51, 0x11A56},
+    {0x11A59, 0x11A5B}, {0x11A8A, 0x11A96}, {0x11A98, 0x11A99},
+    {0x11C30, 0x11C3D}, {0x11C3F, 0x11C3F}, {0x11C92, 0x11CA7},
+    {0x11CAA, 0x11CB0}, {0x11CB2, 0x11CB3}, {0x11CB5, 0x11CB6},
+    {0x11D31, 0x11D45}, {0x11D47, 0x11D47}, {0x11D90, 0x11D91},
+    {0x11D95, 0x11D95}, {0x11D97, 0x11D97}, {0x11EF3, 0x11EF4},
+    {0x16AF0, 0x16AF4}, {0x16B30, 0x16B36}, {0x16F4F, 0x16F4F},
+    {0x16F8F, 0x16F92}, {0x16FE4, 0x16FE4}, {0x1BC9D, 0x1BC9E},
+    {0x1CF00, 0x1CF46}, {0x1D167, 0x1D169}, {0x1D17B, 0x1D182},
+    {0x1D185, 0x1D18B}, {0x1D1AA, 0x1D1AD}, {0x1D242, 0x1D244},
+    {0x1DA00, 0x1DA36}, {0x1DA3B, 0x1DA6C}, {0x1DA75, 0x1DA75},
+    {0x1DA84, 0x1DA84}, {0x1DA9B, 0x1DAAF}, {0x1E000, 0x1E02A},
+    {0x1E130, 0x1E136}, {0x1E2AE, 0x1E2AE}, {0x1E2EC, 0x1E2EF},
+    {0x1E8D0, 0x1E8D6}, {0x1E944, 0x1E94A}, {0xE0100, 0xE01EF},};
+
+#define _TUI_WIDTH_BLOCK_SIZE 256
+#define _TUI_MAX_WIDTH_BLOCKS 128
+
+// The widths of the codepoints, 2 bits each, in blocks of 256 codepoints.
+// Most blocks are all narrow or all wide, so blocks that are the same as an
+// earlier one are stored once.
+uint8_t _tui_width_block_indices[0x110000 / _TUI_WIDTH_BLOCK_SIZE];
+uint8_t _tui_width_blocks[_TUI_MAX_WIDTH_BLOCKS][_TUI_WIDTH_BLOCK_SIZE / 4];
+int _tui_width_blocks_size = 0;
+
+// Sets the widths of the codepoints in block from the ranges, which are
+// sorted. *range is the first one that doesn't end before the block and is
+// moved past the ones that end inside of it.
+void _tui_apply_width_ranges(TUI_WIDTH *widths, uint32_t block_first,
+                             const TUI_CODEPOINT_RANGE *ranges,
+                             size_t ranges_size, size_t *range,
+                             TUI_WIDTH width) {
+  const uint32_t block_last = block_first + _TUI_WIDTH_BLOCK_SIZE - 1;
+  for (size_t i = *range; i < ranges_size && ranges[i].first <= block_last;
+       ++i) {
+    const uint32_t first =
+        ranges[i].first > block_first ? ranges[i].first : block_first;
+    const uint32_t last =
+        ranges[i].last < block_last ? ranges[i].last : block_last;
+    for (uint32_t codepoint = first; codepoint <= last; ++codepoint) {
+      widths[codepoint - block_first] = width;
+    }
+    if (ranges[i].last <= block_last) {
+      *range = i + 1;
+    }
+  }
+}
+
+int _tui_store_width_block(const uint8_t *block) {
+  // blocks that repeat are mostly the uniform ones or the one just before
+  for (int i = 0; i < _tui_width_blocks_size; ++i) {
+    if (memcmp(_tui_width_blocks[i], block, sizeof(*_tui_width_blocks)) ==
+        0) {
+      return i;
+    }
+    if (i == 1 && _tui_width_blocks_size > 3) {
+      i = _tui_width_blocks_size - 2;
+    }
+  }
+  if (_tui_width_blocks_size == _TUI_MAX_WIDTH_BLOCKS) {
+    fprintf(stderr, "too many blocks of character widths\n");
+    exit(1);
+  }
+  memcpy(_tui_width_blocks[_tui_width_blocks_size], block,
+         sizeof(*_tui_width_blocks));
+  return _tui_width_blocks_size++;
+}
+
+void _tui_build_width_table() {
+  if (_tui_width_blocks_size != 0) {
+    return;
+  }
+  uint8_t uniform[_TUI_WIDTH_BLOCK_SIZE / 4];
+  memset(uniform, TUI_WIDTH_NARROW * 0x55, sizeof(uniform));
+  _tui_store_width_block(uniform);
+  memset(uniform, TUI_WIDTH_WIDE * 0x55, sizeof(uniform));
+  _tui_store_width_block(uniform);
+
+  size_t wide_range = 0;
+  size_t zero_width_range = 0;
+  for (uint32_t block_first = 0; block_first < 0x110000;
+       block_first += _TUI_WIDTH_BLOCK_SIZE) {
+    TUI_WIDTH widths[_TUI_WIDTH_BLOCK_SIZE];
+    for (int i = 0; i < _TUI_WIDTH_BLOCK_SIZE; ++i) {
+      const uint32_t codepoint = block_first + i;
+      // controls and surrogates can't be printed
+      const bool is_invalid = codepoint < 0x20 ||
+                              (codepoint >= 0x7F && codepoint < 0xA0) ||
+                              (codepoint >= 0xD800 && codepoint < 0xE000);
+      widths[i] = is_invalid ? TUI_WIDTH_INVALID : TUI_WIDTH_NARROW;
+    }
+    _tui_apply_width_ranges(
+        widths, block_first, _tui_wide_ranges,
+        sizeof(_tui_wide_ranges) / sizeof(*_tui_wide_ranges), &wide_range,
+        TUI_WIDTH_WIDE);
+    _tui_apply_width_ranges(
+        widths, block_first, _tui_zero_width_ranges,
+        sizeof(_tui_zero_width_ranges) / sizeof(*_tui_zero_width_ranges),
+        &zero_width_range, TUI_WIDTH_ZERO);
+
+    uint8_t block[_TUI_WIDTH_BLOCK_SIZE / 4] = {0};
+    for (int i = 0; i < _TUI_WIDTH_BLOCK_SIZE; ++i) {
+      block[i / 4] |= widths[i] << (i % 4 * 2);
+    }
+    _tui_width_block_indices[block_first / _TUI_WIDTH_BLOCK_SIZE] =
+        _tui_store_width_block(block);
+  }
+}
+
+TUI_WIDTH _tui_char_width(uint32_t codepoint) {
+  if (codepoint >= 0x110000) {
+    return TUI_WIDTH_INVALID;
+  }
+  const uint8_t *block =
+      _tui_width_blocks[_tui_width_block_indices[codepoint /
+                                                 _TUI_WIDTH_BLOCK_SIZE]];
+  const uint32_t i = codepoint % _TUI_WIDTH_BLOCK_SIZE;
+  return block[i / 4] >> (i % 4 * 2) & 3;
+}
+
+size_t _tui_decode_utf8(const char *text, size_t size, uint32_t *codepoint) {
+  const uint8_t *bytes = (const uint8_t *)text;
+  if (bytes[0] < 0x80) {
+    *codepoint = bytes[0];
+    return 1;
+  }
+
+  size_t length;
+  uint32_t value;
+  if (bytes[0] >= 0xC2 && bytes[0] < 0xE0) {
+    length = 2;
+    value = bytes[0] & 0x1F;
+  } else if (bytes[0] >= 0xE0 && bytes[0] < 0xF0) {
+    length = 3;
+    value = bytes[0] & 0x0F;
+  } else if (bytes[0] >= 0xF0 && bytes[0] < 0xF5) {
+    length = 4;
+    value = bytes[0] & 0x07;
+  } else {
+    *codepoint = TUI_INVALID_CODEPOINT;
+    return 1;
+  }
+  if (length > size) {
+    *codepoint = TUI_INVALID_CODEPOINT;
+    return 1;
+  }
+  for (size_t i = 1; i < length; ++i) {
+    if ((bytes[i] & 0xC0) != 0x80) {
+      *codepoint = TUI_INVALID_CODEPOINT;
+      return 1;
+    }
+    value = value << 6 | (bytes[i] & 0x3F);
+  }
+
+  // overlong encodings and surrogates are not UTF-8
+  static const uint32_t minimums[] = {0, 0, 0x80, 0x800, 0x10000};
+  if (value < minimums[length] || (value >= 0xD800 && value < 0xE000) ||
+      value >= 0x110000) {
+    *codepoint = TUI_INVALID_CODEPOINT;
+    return 1;
+  }
+  *codepoint = value;
+  return length;
+}
+
+char *_tui_encode_utf8(char *out, uint32_t codepoint) {
+  if (codepoint < 0x80) {
+    *out++ = codepoint;
+  } else if (codepoint < 0x800) {
+    *out++ = 0xC0 | codepoint >> 6;
+    *out++ = 0x80 | (codepoint & 0x3F);
+  } else if (codepoint < 0x10000) {
+    *out++ = 0xE0 | codepoint >> 12;
+    *out++ = 0x80 | (codepoint >> 6 & 0x3F);
+    *out++ = 0x80 | (codepoint & 0x3F);
+  } else {
+    *out++ = 0xF0 | codepoint >> 18;
+    *out++ = 0x80 | (codepoint >> 12 & 0x3F);
+    *out++ = 0x80 | (codepoint >> 6 & 0x3F);
+    *out++ = 0x80 | (codepoint & 0x3F);
+  }
+  return out;
+}
+
+size_t _tui_utf8_size(uint32_t codepoint) {
+  return codepoint < 0x80      ? 1
+         : codepoint < 0x800   ? 2
+         : codepoint < 0x10000 ? 3
+                               : 4;
+}
+
+size_t _tui_printable_run(const char *text, size_t size) {
+  // 8 bytes at a time until a word has a byte with the high bit set, one
+  // below ' ' or a DEL, which is found a byte at a time after
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t high_bits = 0x8080808080808080ULL;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, text + i, sizeof(word));
+    const uint64_t deletes = word ^ (0x7F * ones);
+    const uint64_t special = (((word - 0x20 * ones) & ~word) |
+                              ((deletes - ones) & ~deletes) | word) &
+                             high_bits;
+    if (special != 0) {
+      break;
+    }
+  }
+  while (i < size && (uint8_t)text[i] >= 0x20 && (uint8_t)text[i] < 0x7F) {
+    ++i;
+  }
+  return i;
+}
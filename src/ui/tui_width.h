@@ -0,0 +1,38 @@
+#ifndef A404M_UI_TUI_WIDTH
+#define A404M_UI_TUI_WIDTH 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Columns a codepoint takes on the terminal. Combining marks take none and
+// join the character before them, invalid codepoints are drawn as U+FFFD.
+typedef enum TUI_WIDTH {
+  TUI_WIDTH_ZERO = 0,
+  TUI_WIDTH_NARROW = 1,
+  TUI_WIDTH_WIDE = 2,
+  TUI_WIDTH_INVALID = 3,
+} TUI_WIDTH;
+
+// decoded from bytes that are not UTF-8
+#define TUI_INVALID_CODEPOINT 0xFFFFFFFF
+
+// Fills the width table _tui_char_width looks codepoints up in
+extern void _tui_build_width_table();
+
+extern TUI_WIDTH _tui_char_width(uint32_t codepoint);
+
+// Decodes the codepoint at the start of text, returns its size in bytes. A
+// byte that doesn't start valid UTF-8 is TUI_INVALID_CODEPOINT of size 1.
+extern size_t _tui_decode_utf8(const char *text, size_t size,
+                               uint32_t *codepoint);
+
+// Writes the UTF-8 of a valid codepoint to out, returns the end of it
+extern char *_tui_encode_utf8(char *out, uint32_t codepoint);
+// bytes of the UTF-8 of a valid codepoint
+extern size_t _tui_utf8_size(uint32_t codepoint);
+
+// number of leading bytes of text that are printable ASCII, which take a
+// column each
+extern size_t _tui_printable_run(const char *text, size_t size);
+
+#endif